@@ -2,6 +2,29 @@
 #include <string>
 #include <locale>
 #include <codecvt>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MIRROR_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MIRROR_X86 1
+#include <immintrin.h>
+#endif
 
 // Написать программу, которая по заданному входному
 // текстовому файлу input.txt формирует результирующий текстовый файл
@@ -13,37 +36,741 @@
 // екдяроп.
 // Файл output.txt: Это пример простого теста. Если Вы еще не поняли, то
 // запишите буквы каждого слова в обратном порядке
+//
+// Запуск:
+//   mirror                       - files/input.txt -> files/output.txt через wchar_t
+//   mirror --mmap [in [out]]     - то же самое побайтово, входной файл
+//                                  отображается в память (для больших файлов)
+//   mirror --threads N [in [out]] - побайтово в N потоков (0 - по числу ядер)
+//   --kernel scalar|sse|avx2     - принудительно выбрать ядро побайтового режима
+// Вместо in и out можно указать "-" (стандартные ввод и вывод), тогда
+// работает побайтовый потоковый режим. Пробелы и переводы строк
+// переносятся в результат как есть.
 
 
-/** Возвращает зеркальное отражение строки */
+inline bool IsPunctuation(wchar_t c) {
+    return c == L',' || c == L'.' || c == L'!' || c == L'?';
+}
+
+/**
+ * Возвращает зеркальное отражение строки. Знаки препинания
+ * в начале и в конце слова остаются на своих местах.
+ */
 std::wstring Mirror(const std::wstring& str) {
-    std::wstring mirrored_str;
-    wchar_t punctuation = L'\0';
-    for (int i = str.length() - 1; i >= 0; --i) {
-        if (str[i] == L',' || str[i] == L'.' || str[i] == L'!' || str[i] == L'?') {
-            punctuation = str[i];
+    size_t first = 0, last = str.length();
+    while (first != last && IsPunctuation(str[first])) {
+        ++first;
+    }
+    while (last != first && IsPunctuation(str[last - 1])) {
+        --last;
+    }
+    std::wstring mirrored_str = str;
+    std::reverse(mirrored_str.begin() + first, mirrored_str.begin() + last);
+    return mirrored_str;
+}
+
+
+// Побайтовый движок: слова отражаются прямо в UTF-8, без перевода в wchar_t.
+
+const size_t kOutBufferSize = 1 << 20;      // буфер вывода
+const size_t kInBufferSize = 1 << 20;       // буфер потокового чтения
+const size_t kPieceSize = kOutBufferSize / 4; // кусок длинного слова за один проход
+const size_t kReleaseStep = 64 << 20;       // шаг освобождения прочитанных страниц
+const size_t kChunkSize = 8 << 20;          // кусок входа для одного потока
+const size_t kChunksPerThread = 4;          // кусков на поток за раунд
+const size_t kShortWord = 16;               // короче - векторное ядро не нужно
+
+inline bool IsSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool IsPunctuation(char c) {
+    return c == ',' || c == '.' || c == '!' || c == '?';
+}
+
+// Байт продолжения UTF-8 (10xxxxxx)
+inline bool IsContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// После разворота байтов многобайтный символ идёт задом наперёд: сначала
+// продолжения, потом ведущий байт. Возвращает их на место, начиная с p,
+// и отдаёт позицию за символом.
+inline char* FixSequence(char* p, char* last) {
+    char* q = p;
+    while (q != last && IsContinuation(*q)) {
+        ++q;
+    }
+    if (q != last && static_cast<unsigned char>(*q) >= 0xC0) {
+        std::reverse(p, q + 1);
+        return q + 1;
+    }
+    return q; // битая последовательность - оставляем как есть
+}
+
+
+// Ядра отражения. Слово копируется задом наперёд побайтово, после чего
+// многобайтные символы разворачиваются обратно. Векторные варианты
+// переворачивают сразу по 16/32 байт и пропускают ASCII-блоки целиком;
+// вариант выбирается при запуске по возможностям процессора.
+struct Kernel {
+    // dst[i] = src[n - 1 - i]
+    void (*reverse_copy)(const char* src, size_t n, char* dst);
+    // FixSequence для всех символов [p, last)
+    void (*fix_utf8)(char* p, char* last);
+};
+
+inline void ReverseCopyScalar(const char* src, size_t n, char* dst) {
+    while (n != 0) {
+        *dst++ = src[--n];
+    }
+}
+
+inline void FixUtf8Scalar(char* p, char* last) {
+    while (p != last) {
+        p = IsContinuation(*p) ? FixSequence(p, last) : p + 1;
+    }
+}
+
+const Kernel kScalarKernel = {ReverseCopyScalar, FixUtf8Scalar};
+
+#ifdef MIRROR_X86
+__attribute__((target("ssse3")))
+inline void ReverseCopySse(const char* src, size_t n, char* dst) {
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    while (n >= 16) {
+        n -= 16;
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + n));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(v, reverse));
+        dst += 16;
+    }
+    ReverseCopyScalar(src, n, dst);
+}
+
+// Обрабатывает 16 байт с p, если в них только ASCII и двухбайтные символы
+// (кириллица). Возвращает число обработанных байт либо 0, если блок
+// нужно разбирать посимвольно.
+__attribute__((target("ssse3")))
+inline size_t FixBlockSse(char* p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int high = _mm_movemask_epi8(v);
+    if (high == 0) {
+        return 16;
+    }
+    const __m128i top2 = _mm_set1_epi8(static_cast<char>(0xC0));
+    const __m128i top3 = _mm_set1_epi8(static_cast<char>(0xE0));
+    __m128i cont = _mm_cmpeq_epi8(_mm_and_si128(v, top2), _mm_set1_epi8(static_cast<char>(0x80)));
+    __m128i lead = _mm_cmpeq_epi8(_mm_and_si128(v, top3), top2);
+    __m128i wide = _mm_cmpeq_epi8(_mm_and_si128(v, top3), top3);
+    unsigned cont_mask = _mm_movemask_epi8(cont);
+    unsigned lead_mask = _mm_movemask_epi8(lead);
+    // За каждым продолжением должен сразу идти ведущий байт двухбайтного символа
+    if (_mm_movemask_epi8(wide) != 0 || ((cont_mask << 1) & 0xFFFF) != lead_mask) {
+        return 0;
+    }
+    // Продолжение в последнем байте относится к следующему блоку
+    size_t length = 16;
+    if (cont_mask & 0x8000) {
+        cont = _mm_and_si128(cont, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                                 -1, -1, -1, -1, -1, -1, -1, 0));
+        length = 15;
+    }
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    index = _mm_add_epi8(index, _mm_and_si128(cont, one));
+    index = _mm_sub_epi8(index, _mm_and_si128(_mm_slli_si128(cont, 1), one));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_shuffle_epi8(v, index));
+    return length;
+}
+
+__attribute__((target("ssse3")))
+void FixUtf8Sse(char* p, char* last) {
+    while (p != last) {
+        size_t done = last - p >= 16 ? FixBlockSse(p) : 0;
+        if (done != 0) {
+            p += done;
+        } else {
+            p = IsContinuation(*p) ? FixSequence(p, last) : p + 1;
+        }
+    }
+}
+
+const Kernel kSseKernel = {ReverseCopySse, FixUtf8Sse};
+
+__attribute__((target("avx2")))
+void ReverseCopyAvx2(const char* src, size_t n, char* dst) {
+    // vpshufb работает внутри 128-битных половин, поэтому половины
+    // переворачиваются по отдельности и затем меняются местами
+    const __m256i reverse = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    while (n >= 32) {
+        n -= 32;
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + n));
+        v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), 0x4E);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);
+        dst += 32;
+    }
+    ReverseCopySse(src, n, dst);
+}
+
+__attribute__((target("avx2")))
+void FixUtf8Avx2(char* p, char* last) {
+    while (p != last) {
+        size_t done = 0;
+        if (last - p >= 32 &&
+            _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))) == 0) {
+            done = 32;
+        } else if (last - p >= 16) {
+            done = FixBlockSse(p);
+        }
+        if (done != 0) {
+            p += done;
         } else {
-            mirrored_str += str[i];
+            p = IsContinuation(*p) ? FixSequence(p, last) : p + 1;
         }
     }
-    return mirrored_str + punctuation;
 }
 
-int main() {
-    std::wifstream fin(L"files/input.txt");
-    std::wofstream fout(L"files/output.txt");
-    
+const Kernel kAvx2Kernel = {ReverseCopyAvx2, FixUtf8Avx2};
+#endif
+
+/** Ядро по имени (scalar, sse, avx2) либо лучшее доступное, если имя пустое */
+const Kernel* SelectKernel(const std::string& name) {
+#ifdef MIRROR_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse = __builtin_cpu_supports("ssse3");
+    if ((name.empty() || name == "avx2") && avx2) {
+        return &kAvx2Kernel;
+    }
+    if ((name.empty() || name == "sse") && sse) {
+        return &kSseKernel;
+    }
+#endif
+    if (name.empty() || name == "scalar") {
+        return &kScalarKernel;
+    }
+    return nullptr;
+}
+
+const Kernel* kernel = &kScalarKernel;
+
+
+#ifdef MIRROR_POSIX
+/** Буферизованный вывод в файловый дескриптор крупными блоками */
+class OutputBuffer {
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+
+public:
+    explicit OutputBuffer(int fd_) : fd(fd_), buffer(kOutBufferSize) {}
+
+    ~OutputBuffer() {
+        Flush();
+    }
+
+    // Место под n байт (n <= kOutBufferSize); заполненное фиксируется Commit
+    char* Reserve(size_t n) {
+        if (used + n > buffer.size()) {
+            Flush();
+        }
+        return buffer.data() + used;
+    }
+
+    void Commit(size_t n) {
+        used += n;
+    }
+
+    void Write(const char* data, size_t n) {
+        while (n != 0) {
+            size_t part = std::min(n, kPieceSize);
+            std::memcpy(Reserve(part), data, part);
+            Commit(part);
+            data += part;
+            n -= part;
+        }
+    }
+
+    void Flush() {
+        const char* p = buffer.data();
+        while (used != 0 && !failed) {
+            ssize_t written = ::write(fd, p, used);
+            if (written < 0) {
+                failed = true;
+                break;
+            }
+            p += written;
+            used -= written;
+        }
+        used = 0;
+    }
+
+    bool Failed() const {
+        return failed;
+    }
+};
+
+
+/** Результат обработки одного куска входа в параллельном режиме */
+class ChunkBuffer {
+private:
+    std::vector<char> buffer;
+    size_t used = 0;
+
+public:
+    char* Reserve(size_t n) {
+        if (used + n > buffer.size()) {
+            buffer.resize(std::max(used + n, buffer.size() * 2));
+        }
+        return buffer.data() + used;
+    }
+
+    void Commit(size_t n) {
+        used += n;
+    }
+
+    void Write(const char* data, size_t n) {
+        std::memcpy(Reserve(n), data, n);
+        Commit(n);
+    }
+
+    void Clear() {
+        used = 0;
+    }
+
+    const char* data() const {
+        return buffer.data();
+    }
+
+    size_t size() const {
+        return used;
+    }
+};
+
+
+/**
+ * Дописывает в out зеркальное отражение слова [begin, end).
+ * Знаки препинания в начале и в конце слова остаются на своих местах,
+ * отражается только середина. Длинные слова обрабатываются кусками
+ * с конца, так что память ограничена буфером вывода, а не длиной слова.
+ */
+template <typename Out>
+void MirrorWord(const char* begin, const char* end, Out& out) {
+    const char* first = begin;
+    while (first != end && IsPunctuation(*first)) {
+        ++first;
+    }
+    const char* last = end;
+    while (last != first && IsPunctuation(*(last - 1))) {
+        --last;
+    }
+    out.Write(begin, first - begin);
+
+    for (const char* right = last; right != first; ) {
+        const char* piece = right - std::min<size_t>(right - first, kPieceSize);
+        const char* aligned = piece;
+        while (aligned != right && IsContinuation(*aligned)) {
+            ++aligned;
+        }
+        if (aligned != right) {
+            piece = aligned;
+        }
+
+        size_t n = right - piece;
+        char* dst = out.Reserve(n);
+        if (n < kShortWord) {
+            // На коротких словах косвенный вызов ядра дороже самой работы
+            ReverseCopyScalar(piece, n, dst);
+            FixUtf8Scalar(dst, dst + n);
+        } else {
+            kernel->reverse_copy(piece, n, dst);
+            kernel->fix_utf8(dst, dst + n);
+        }
+        out.Commit(n);
+        right = piece;
+    }
+
+    out.Write(last, end - last);
+}
+
+/** Отражает все слова диапазона [p, last), пробелы и переводы строк копирует */
+template <typename Out>
+void MirrorRange(const char* p, const char* last, Out& out) {
+    while (p != last) {
+        const char* space = p;
+        while (p != last && IsSpace(*p)) {
+            ++p;
+        }
+        out.Write(space, p - space);
+        const char* word = p;
+        while (p != last && !IsSpace(*p)) {
+            ++p;
+        }
+        if (word != p) {
+            MirrorWord(word, p, out);
+        }
+    }
+}
+
+// Ближайшая граница слова не раньше p. Пробельные символы - ASCII,
+// поэтому такая граница никогда не разрезает символ UTF-8.
+inline const char* NextBoundary(const char* p, const char* last) {
+    while (p != last && !IsSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Длина метки порядка байтов в начале текста (0, если её нет)
+inline size_t BomLength(const char* p, size_t n) {
+    return n >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+}
+
+
+/** Обычный файл, целиком отображённый в память только для чтения */
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+
+public:
+    // Не захватывает fd; IsMapped() ложно для пустых и необычных файлов
+    explicit MappedFile(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            return;
+        }
+        void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            return;
+        }
+        data = static_cast<const char*>(addr);
+        length = st.st_size;
+        ::madvise(addr, length, MADV_SEQUENTIAL);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            ::munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    bool IsMapped() const {
+        return data != nullptr;
+    }
+
+    const char* begin() const {
+        return data;
+    }
+
+    const char* end() const {
+        return data + length;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    // Отдаёт системе уже прочитанные страницы [0, offset), чтобы
+    // резидентная память не росла вместе с размером файла
+    void Release(size_t offset) {
+        size_t page = ::sysconf(_SC_PAGESIZE);
+        offset -= offset % page;
+        if (offset != 0) {
+            ::madvise(const_cast<char*>(data), offset, MADV_DONTNEED);
+        }
+    }
+};
+
+
+/** Записывает куски целиком, группами по IOV_MAX через writev */
+bool WriteChunks(int fd, const std::vector<ChunkBuffer>& chunks, size_t count) {
+    std::vector<iovec> iov;
+    for (size_t i = 0; i != count; ++i) {
+        if (chunks[i].size() != 0) {
+            iov.push_back({const_cast<char*>(chunks[i].data()), chunks[i].size()});
+        }
+    }
+    size_t first = 0;
+    while (first != iov.size()) {
+        int n = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t written = ::writev(fd, iov.data() + first, n);
+        if (written < 0) {
+            return false;
+        }
+        while (written > 0) {
+            size_t len = iov[first].iov_len;
+            if (static_cast<size_t>(written) < len) {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+                iov[first].iov_len -= written;
+                written = 0;
+            } else {
+                written -= len;
+                ++first;
+            }
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Параллельное отражение: вход режется на куски по границам слов,
+ * куски раунда разбирают потоки, а результаты пишутся по порядку.
+ * Пока потоки считают следующий раунд, главный поток пишет предыдущий,
+ * так что память ограничена двумя раундами, а не размером файла.
+ */
+bool MirrorParallel(MappedFile& fin, const char* p, int out_fd, size_t threads) {
+    const size_t per_round = threads * kChunksPerThread;
+    std::vector<ChunkBuffer> ready(per_round), pending(per_round);
+    std::vector<const char*> bounds(per_round + 1);
+    size_t ready_count = 0;
+    const char* last = fin.end();
+    bool ok = true;
+
+    while (p != last || ready_count != 0) {
+        size_t count = 0;
+        bounds[0] = p;
+        while (count != per_round && bounds[count] != last) {
+            const char* from = bounds[count];
+            bounds[count + 1] = NextBoundary(from + std::min<size_t>(last - from, kChunkSize), last);
+            ++count;
+        }
+
+        // Потоки живут один раунд: их запуск несравнимо дешевле
+        // обработки count * kChunkSize байт
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t != std::min(threads, count); ++t) {
+            workers.emplace_back([&] {
+                for (size_t i = next++; i < count; i = next++) {
+                    pending[i].Clear();
+                    MirrorRange(bounds[i], bounds[i + 1], pending[i]);
+                }
+            });
+        }
+        if (ok && ready_count != 0) {
+            ok = WriteChunks(out_fd, ready, ready_count);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (count != 0) {
+            p = bounds[count];
+            fin.Release(p - fin.begin());
+        }
+        std::swap(ready, pending);
+        ready_count = count;
+    }
+    return ok;
+}
+
+
+/** Последовательное отражение с освобождением прочитанных страниц */
+bool MirrorSerial(MappedFile& fin, const char* p, OutputBuffer& fout) {
+    const char* last = fin.end();
+    while (p != last) {
+        const char* step = NextBoundary(p + std::min<size_t>(last - p, kReleaseStep), last);
+        MirrorRange(p, step, fout);
+        p = step;
+        fin.Release(p - fin.begin());
+    }
+    fout.Flush();
+    return !fout.Failed();
+}
+
+
+/**
+ * Потоковое отражение для каналов и прочих неотображаемых входов.
+ * Обрабатывается всё до последнего пробельного символа в буфере,
+ * недочитанное слово переносится в начало. Буфер растёт только если
+ * одно слово длиннее его. В перенесённом слове пробельных символов нет,
+ * поэтому граница ищется только среди новых байтов - иначе длинное слово
+ * просматривалось бы заново после каждого read().
+ */
+bool MirrorStream(int in_fd, OutputBuffer& fout) {
+    std::vector<char> buffer(kInBufferSize);
+    size_t filled = 0;
+    size_t scanned = 0; // начало буфера без пробельных символов
+    bool at_start = true;
+    while (true) {
+        ssize_t got = ::read(in_fd, buffer.data() + filled, buffer.size() - filled);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        filled += got;
+        bool eof = got == 0;
+
+        const char* p = buffer.data();
+        const char* last = p + filled;
+        if (at_start) {
+            if (filled < 3 && !eof) {
+                continue;
+            }
+            size_t bom = BomLength(p, filled);
+            fout.Write(p, bom);
+            p += bom;
+            at_start = false;
+        }
+
+        const char* boundary = last;
+        if (!eof) {
+            const char* known = std::max<const char*>(p, buffer.data() + scanned);
+            while (boundary != known && !IsSpace(*(boundary - 1))) {
+                --boundary;
+            }
+            if (boundary == known) {
+                boundary = p;
+            }
+        }
+        MirrorRange(p, boundary, fout);
+        filled = last - boundary;
+        scanned = filled;
+        std::memmove(buffer.data(), boundary, filled);
+        if (eof) {
+            break;
+        }
+        if (filled == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+    fout.Flush();
+    return !fout.Failed();
+}
+
+
+/**
+ * Побайтово отражает слова in_path в out_path ("-" - стандартные потоки).
+ * Обычный файл отображается в память, остальное читается потоково.
+ */
+bool MirrorBytes(const char* in_path, const char* out_path, size_t threads) {
+    bool from_stdin = std::strcmp(in_path, "-") == 0;
+    bool to_stdout = std::strcmp(out_path, "-") == 0;
+    int in_fd = from_stdin ? STDIN_FILENO : ::open(in_path, O_RDONLY);
+    if (in_fd < 0) {
+        std::perror(in_path);
+        return false;
+    }
+    int out_fd = to_stdout ? STDOUT_FILENO : ::open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        std::perror(out_path);
+        if (!from_stdin) {
+            ::close(in_fd);
+        }
+        return false;
+    }
+
+    bool ok;
+    {
+        MappedFile fin(in_fd);
+        OutputBuffer fout(out_fd);
+        if (!fin.IsMapped()) {
+            ok = MirrorStream(in_fd, fout);
+        } else {
+            size_t bom = BomLength(fin.begin(), fin.size());
+            fout.Write(fin.begin(), bom);
+            if (threads > 1) {
+                fout.Flush();
+                ok = !fout.Failed() && MirrorParallel(fin, fin.begin() + bom, out_fd, threads);
+            } else {
+                ok = MirrorSerial(fin, fin.begin() + bom, fout);
+            }
+        }
+    }
+    if (!from_stdin) {
+        ::close(in_fd);
+    }
+    if ((!to_stdout && ::close(out_fd) != 0) || !ok) {
+        std::perror(out_path);
+        return false;
+    }
+    return true;
+}
+#endif
+
+
+int MirrorWide(const char* in_path, const char* out_path) {
+    std::wifstream fin(in_path);
+    std::wofstream fout(out_path);
+
     fin.imbue(std::locale(fin.getloc(), new std::codecvt_utf8<wchar_t>));
     fout.imbue(std::locale(fout.getloc(), new std::codecvt_utf8<wchar_t>));
-    
-    if (fin.is_open() && fout.is_open()) {
-        fout << L"\xFEFF";
 
+    if (fin.is_open() && fout.is_open()) {
         std::wstring word;
-        while (fin >> word) {
-            fout << Mirror(word);
+        wchar_t ch;
+        bool at_start = true;
+        while (fin.get(ch)) {
+            if (at_start && ch == L'\xFEFF') {
+                fout << ch;
+            } else if (ch == L' ' || ch == L'\n' || ch == L'\t' ||
+                       ch == L'\r' || ch == L'\v' || ch == L'\f') {
+                fout << Mirror(word) << ch;
+                word.clear();
+            } else {
+                word += ch;
+            }
+            at_start = false;
         }
-    } 
+        fout << Mirror(word);
+    }
     fin.close();
     fout.close();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* paths[] = {"files/input.txt", "files/output.txt"};
+    size_t path_count = 0;
+    bool bytes = false;
+    size_t threads = 1;
+    bool forced_kernel = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--mmap") == 0) {
+            bytes = true;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            bytes = true;
+            threads = std::strtoul(argv[++i], nullptr, 10);
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        } else if (std::strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            kernel = SelectKernel(argv[++i]);
+            if (kernel == nullptr) {
+                std::fprintf(stderr, "kernel %s is not available\n", argv[i]);
+                return 1;
+            }
+            forced_kernel = true;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+            bytes = bytes || std::strcmp(argv[i], "-") == 0;
+        } else {
+            std::fputs("usage: mirror [--mmap] [--threads N] [--kernel NAME] [input [output]]\n", stderr);
+            return 1;
+        }
+    }
+
+    if (bytes) {
+#ifdef MIRROR_POSIX
+        if (!forced_kernel) {
+            kernel = SelectKernel("");
+        }
+        return MirrorBytes(paths[0], paths[1], threads) ? 0 : 1;
+#else
+        std::fputs("byte mode is not supported on this platform\n", stderr);
+        return 1;
+#endif
+    }
+    return MirrorWide(paths[0], paths[1]);
 }
@@ -2,81 +2,461 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <map>
-#include <set>
+#include <array>
+#include <fstream>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
 
 
-//  Переводит текстовый шифр в двоичный код
-std::string MessageToCode(const std::string& msg, const std::vector<std::string>& alphabet)
-{
-    std::string sorted_msg = msg;
-    std::sort(sorted_msg.begin(), sorted_msg.end());
+// Двоичная строка, упакованная по 64 бита в слово: бит i лежит
+// в words[i / 64] на позиции i % 64
+class BitString {
+private:
+    std::vector<uint64_t> words;
+    size_t length = 0;
+
+public:
+    BitString() = default;
 
-    std::set<char> letters;
-    std::map<char, std::string> alphabet_map;
+    // Из строки вида "0110"; символы кроме '1' считаются нулями
+    explicit BitString(const std::string& bits) {
+        words.reserve((bits.size() + 63) / 64);
+        for (char c : bits) {
+            PushBack(c == '1');
+        }
+    }
 
-    for (auto c : msg) {
-        letters.insert(c);
+    size_t size() const {
+        return length;
     }
 
-    size_t i = 0;
-    for (auto l : letters) {
-        alphabet_map[l] = alphabet[i];
-        ++i;
+    bool operator[](size_t i) const {
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+
+    void PushBack(bool bit) {
+        if (length % 64 == 0) {
+            words.push_back(0);
+        }
+        words.back() |= static_cast<uint64_t>(bit) << (length % 64);
+        ++length;
     }
 
-    std::string code_str;
-    for (auto c : msg) {
-        for (const auto& [k, v] : alphabet_map) {
-            if (c == k) {
-                code_str += v;
+    // Дописывает count (<= 64) младших бит bits, начиная с младшего
+    void Append(uint64_t bits, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        if (count < 64) {
+            bits &= (uint64_t(1) << count) - 1;
+        }
+        size_t offset = length % 64;
+        if (offset == 0) {
+            words.push_back(bits);
+        } else {
+            words.back() |= bits << offset;
+            if (offset + count > 64) {
+                words.push_back(bits >> (64 - offset));
             }
         }
+        length += count;
+    }
+
+    void Append(const BitString& bits) {
+        size_t full = bits.length / 64;
+        for (size_t w = 0; w != full; ++w) {
+            Append(bits.words[w], 64);
+        }
+        if (bits.length % 64 != 0) {
+            Append(bits.words[full], bits.length % 64);
+        }
+    }
+
+    void Reserve(size_t bits) {
+        words.reserve((bits + 63) / 64);
+    }
+
+    // 64 бита начиная с i (за концом строки - нули)
+    uint64_t Window(size_t i) const {
+        size_t w = i / 64, offset = i % 64;
+        uint64_t bits = w < words.size() ? words[w] >> offset : 0;
+        if (offset != 0 && w + 1 < words.size()) {
+            bits |= words[w + 1] << (64 - offset);
+        }
+        return bits;
+    }
+};
+
+
+// Кодировщик шифра: различные буквы сообщения по возрастанию (как char)
+// получают коды алфавита по порядку. Работает в три прохода по таблицам
+// на 256 символов: подсчёт букв, назначение кодов, упаковка результата.
+// Подсчёт и упаковку можно вести кусками, не держа сообщение в памяти.
+class MessageEncoder {
+private:
+    std::array<size_t, 256> counts{};
+    std::array<BitString, 256> codes;
+
+    static size_t Index(char c) {
+        return static_cast<unsigned char>(c);
+    }
+
+public:
+    // Пробельные символы в шифр не входят и пропускаются
+    static bool IsSkipped(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    void Count(const char* p, size_t n) {
+        for (const char* last = p + n; p != last; ++p) {
+            ++counts[Index(*p)];
+        }
+    }
+
+    size_t LettersNumber() const {
+        size_t letters = 0;
+        for (size_t c = 0; c != counts.size(); ++c) {
+            letters += counts[c] != 0 && !IsSkipped(static_cast<char>(c));
+        }
+        return letters;
+    }
+
+    // Раздаёт коды; false, если кодов меньше, чем различных букв
+    bool AssignCodes(const std::vector<std::string>& alphabet) {
+        size_t i = 0;
+        for (int c = CHAR_MIN; c <= CHAR_MAX; ++c) {
+            if (counts[Index(c)] == 0 || IsSkipped(c)) {
+                continue;
+            }
+            if (i == alphabet.size()) {
+                return false;
+            }
+            codes[Index(c)] = BitString(alphabet[i++]);
+        }
+        return true;
+    }
+
+    // Длина кода всего подсчитанного текста в битах
+    size_t CodeLength() const {
+        size_t bits = 0;
+        for (size_t c = 0; c != counts.size(); ++c) {
+            bits += counts[c] * codes[c].size();
+        }
+        return bits;
+    }
+
+    void Encode(const char* p, size_t n, BitString& code) const {
+        for (const char* last = p + n; p != last; ++p) {
+            code.Append(codes[Index(*p)]);
+        }
+    }
+};
+
+
+//  Переводит текстовый шифр в двоичный код; в алфавите должно быть
+//  не меньше кодов, чем различных букв в msg
+BitString MessageToCode(const std::string& msg, const std::vector<std::string>& alphabet)
+{
+    MessageEncoder encoder;
+    encoder.Count(msg.data(), msg.size());
+    encoder.AssignCodes(alphabet);
+    BitString code;
+    code.Reserve(encoder.CodeLength());
+    encoder.Encode(msg.data(), msg.size(), code);
+    return code;
+}
+
+
+// Кодирует шифр из файла, читая его кусками в два прохода
+bool FileToCode(const char* path, const std::vector<std::string>& alphabet, BitString& code) {
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin.is_open()) {
+        std::cout << "Can\'t open " << path << '\n';
+        return false;
+    }
+    std::vector<char> buffer(1 << 20);
+    auto for_each_chunk = [&](auto handle) {
+        fin.clear();
+        fin.seekg(0);
+        while (fin.read(buffer.data(), buffer.size()) || fin.gcount() != 0) {
+            handle(buffer.data(), static_cast<size_t>(fin.gcount()));
+        }
+    };
+
+    MessageEncoder encoder;
+    for_each_chunk([&](const char* p, size_t n) { encoder.Count(p, n); });
+    if (!encoder.AssignCodes(alphabet)) {
+        std::cout << "Not enough codes for " << encoder.LettersNumber() << " letters" << '\n';
+        return false;
     }
-    return code_str;
+    code = BitString();
+    code.Reserve(encoder.CodeLength());
+    for_each_chunk([&](const char* p, size_t n) { encoder.Encode(p, n, code); });
+    return true;
 }
 
 
-int CountSplits(const std::string& code_str, const std::vector<std::string>& alphabet) {
-    std::string cur_str;
-    int max_splits = -1;
-    for (size_t i = 0; i < code_str.size(); ++i) {
-        cur_str += code_str[i];
+// Двоичный префиксный бор кодовых слов. Узлы лежат в одном массиве,
+// переходы - индексы в нём, так что обход не трогает кучу. Первые
+// kRootBits бит проходятся одним обращением к таблице по окну кода.
+class CodeTrie {
+private:
+    static const size_t kRootBits = 8;
 
-        if (std::find(alphabet.begin(), alphabet.end(), cur_str) != alphabet.end()) {
-            return max_splits;
+    struct Node {
+        uint32_t child[2] = {0, 0}; // 0 - перехода нет (в корень не ведёт никто)
+        bool terminal = false;
+    };
+
+    // Итог прохода kRootBits бит от корня: либо длина найденного
+    // слова, либо узел, в котором оказались (0 - тупик)
+    struct RootStep {
+        uint32_t match = 0;
+        uint32_t node = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<RootStep> root;
+    size_t longest = 0; // длина самого длинного слова в боре
+
+    // Проходит count бит window от узла v; depth - уже пройденная глубина
+    size_t Walk(uint32_t& v, uint64_t window, size_t count, size_t depth) const {
+        for (size_t b = 0; b != count; ++b, window >>= 1) {
+            v = nodes[v].child[window & 1];
+            if (v == 0) {
+                return 0;
+            }
+            if (nodes[v].terminal) {
+                return depth + b + 1;
+            }
+        }
+        return 0;
+    }
+
+public:
+    explicit CodeTrie(const std::vector<std::string>& alphabet) : nodes(1) {
+        size_t total = 0;
+        for (const auto& word : alphabet) {
+            total += word.size();
+        }
+        nodes.reserve(total + 1);
+        for (const auto& word : alphabet) {
+            // слово с символами кроме 0 и 1 не встретится в двоичном коде
+            if (word.empty() || word.find_first_not_of("01") != std::string::npos) {
+                continue;
+            }
+            uint32_t v = 0;
+            for (char c : word) {
+                int bit = c - '0';
+                if (nodes[v].child[bit] == 0) {
+                    nodes[v].child[bit] = nodes.size();
+                    nodes.emplace_back();
+                }
+                v = nodes[v].child[bit];
+            }
+            nodes[v].terminal = true;
+            longest = std::max(longest, word.size());
+        }
+
+        root.resize(size_t(1) << kRootBits);
+        for (size_t bits = 0; bits != root.size(); ++bits) {
+            uint32_t v = 0;
+            root[bits].match = Walk(v, bits, kRootBits, 0);
+            root[bits].node = v;
         }
+    }
 
-        if (i + 2 <= code_str.size()) {
-            int tmp = CountSplits(code_str.substr(i+1), alphabet);
+    // FirstMatch не длиннее этого
+    size_t MaxLength() const {
+        return longest;
+    }
 
-            if (tmp != -1) {
-                max_splits = std::max(1 + tmp, max_splits);
+    // Длина кратчайшего кодового слова, с которого начинается code[i..], или 0
+    size_t FirstMatch(const BitString& code, size_t i) const {
+        size_t left = code.size() - i;
+        uint64_t window = code.Window(i);
+        uint32_t v = 0;
+        size_t depth = 0;
+        if (left >= kRootBits) {
+            const RootStep& step = root[window & ((1 << kRootBits) - 1)];
+            if (step.match != 0 || step.node == 0) {
+                return step.match;
             }
+            v = step.node;
+            window >>= kRootBits;
+            depth = kRootBits;
+        }
+        while (true) {
+            size_t count = std::min<size_t>(left - depth, 64 - depth % 64);
+            if (size_t match = Walk(v, window, count, depth)) {
+                return match;
+            }
+            if (v == 0 || depth + count == left) {
+                return 0;
+            }
+            depth += count;
+            window = code.Window(i + depth);
         }
     }
-    return std::max(max_splits, 1); 
+};
+
+
+// Наибольшее число частей, на которые можно разрезать код так, чтобы ни одна
+// часть не начиналась с кодового слова; -1, если так разрезать нельзя.
+// Динамика по суффиксам: splits[i] - ответ для code_str[i..]. Первая часть
+// суффикса может быть длиной от 1 до первого совпадения с кодовым словом
+// (не включая его), так что перебор ограничен длиной самого длинного слова L,
+// а без совпадения берётся максимум по всем более коротким суффиксам.
+// Нужны только splits[i + 1 .. i + L), поэтому они лежат в кольцевом
+// буфере на L + 1 значение. Время O(n·L), память O(L) помимо кода.
+int CountSplits(const BitString& code_str, const CodeTrie& codes) {
+    const size_t n = code_str.size();
+    const size_t ring = codes.MaxLength() + 1;
+    std::vector<int> splits(ring, -1); // splits[i % ring]
+    int suffix_best = -1; // максимум splits[j] по j > i
+    for (size_t i = n; i-- > 0; ) {
+        size_t hit = codes.FirstMatch(code_str, i);
+        int best = -1;
+        if (hit == 0) {
+            best = std::max(suffix_best == -1 ? -1 : suffix_best + 1, 1);
+        } else {
+            for (size_t j = i + 1; j < i + hit; ++j) {
+                best = std::max(best, splits[j % ring]);
+            }
+            if (best != -1) {
+                ++best;
+            }
+        }
+        splits[i % ring] = best;
+        suffix_best = std::max(suffix_best, best);
+    }
+    return n == 0 ? 1 : splits[0];
+}
+
+int CountSplits(const BitString& code_str, const std::vector<std::string>& alphabet) {
+    return CountSplits(code_str, CodeTrie(alphabet));
 }
 
 
-int main(){
+// Пакетный режим: один алфавит на много сообщений. Бор строится один раз,
+// сообщения решаются в threads потоков, ответы печатаются в порядке ввода:
+// число частей, -1 если разрезать нельзя, "error" если не хватило кодов.
+int RunBatch(const char* alphabet_path, const char* messages_path, size_t threads) {
+    std::ifstream alphabet_in(alphabet_path);
+    std::ifstream messages_in(messages_path);
+    if (!alphabet_in.is_open() || !messages_in.is_open()) {
+        std::cerr << "Can\'t open " << (alphabet_in.is_open() ? messages_path : alphabet_path) << '\n';
+        return 1;
+    }
+    std::vector<std::string> alphabet;
+    for (std::string word; alphabet_in >> word; ) {
+        alphabet.push_back(word);
+    }
+    std::vector<std::string> messages;
+    for (std::string message; messages_in >> message; ) {
+        messages.push_back(std::move(message));
+    }
+
+    const CodeTrie codes(alphabet);
+    const int kNoCodes = -2;
+    std::vector<int> results(messages.size());
+    std::atomic<size_t> next{0};
+    auto solve = [&] {
+        for (size_t i = next++; i < messages.size(); i = next++) {
+            const std::string& message = messages[i];
+            MessageEncoder encoder;
+            encoder.Count(message.data(), message.size());
+            if (!encoder.AssignCodes(alphabet)) {
+                results[i] = kNoCodes;
+                continue;
+            }
+            BitString code;
+            code.Reserve(encoder.CodeLength());
+            encoder.Encode(message.data(), message.size(), code);
+            results[i] = CountSplits(code, codes);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(threads, messages.size()); ++t) {
+        workers.emplace_back(solve);
+    }
+    solve();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::string out;
+    for (int res : results) {
+        out += res == kNoCodes ? "error" : std::to_string(res);
+        out += '\n';
+    }
+    std::cout << out << std::flush;
+    return 0;
+}
+
+
+// Запуск:
+//   stirlitz                  - k, сообщение и коды вводятся с клавиатуры
+//   stirlitz --message FILE   - сообщение читается из файла (может быть
+//                               очень большим), k и коды - с клавиатуры
+//   stirlitz --batch ALPHABET MESSAGES [--threads N]
+//                             - коды из файла ALPHABET через пробельные
+//                               символы, сообщения из MESSAGES, без подсказок
+int main(int argc, char* argv[]){
+    const char* message_path = nullptr;
+    if (argc == 3 && std::string(argv[1]) == "--message") {
+        message_path = argv[2];
+    } else if ((argc == 4 || argc == 6) && std::string(argv[1]) == "--batch") {
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        if (argc == 6 && std::string(argv[4]) == "--threads") {
+            threads = std::max<size_t>(1, std::strtoul(argv[5], nullptr, 10));
+        } else if (argc == 6) {
+            std::cout << "usage: stirlitz --batch ALPHABET MESSAGES [--threads N]" << '\n';
+            return 1;
+        }
+        return RunBatch(argv[2], argv[3], threads);
+    } else if (argc != 1) {
+        std::cout << "usage: stirlitz [--message FILE | --batch ALPHABET MESSAGES [--threads N]]" << '\n';
+        return 1;
+    }
+
     size_t k;
     std::cout << "k = "; std::cin >> k;
     std::vector<std::string> alphabet;
     alphabet.reserve(k);
     std::string message;
-    std::cout << "Enter a message: "; std::cin >> message;
+    if (message_path == nullptr) {
+        std::cout << "Enter a message: "; std::cin >> message;
+    }
     std::cout << "Enter codes sep-ed with Enter:\n";
-    for (int i = 0 ; i < k; i++) {
+    for (size_t i = 0 ; i < k; i++) {
         std::string word;
         std::cin >> word;
         alphabet.push_back(word);
     }
-    std::string code = MessageToCode(message, alphabet);
+
+    BitString code;
+    if (message_path != nullptr) {
+        if (!FileToCode(message_path, alphabet, code)) {
+            return 1;
+        }
+    } else {
+        MessageEncoder encoder;
+        encoder.Count(message.data(), message.size());
+        if (!encoder.AssignCodes(alphabet)) {
+            std::cout << "Not enough codes for " << encoder.LettersNumber() << " letters" << '\n';
+            return 1;
+        }
+        code.Reserve(encoder.CodeLength());
+        encoder.Encode(message.data(), message.size(), code);
+    }
     int res = CountSplits(code, alphabet);
     if (res == -1) {
         std::cout << "Message cant\'be split" << '\n';
     } else {
         std::cout << "Message can be split into " << res << " parts" << '\n';
     }
-}
\ No newline at end of file
+}
@@ -1,32 +1,577 @@
 #include <iostream>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <charconv>
+#include <functional>
+#include <map>
+#include <string_view>
+#include <optional>
+#include <memory>
+#include <fstream>
+#include <cstring>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BLP_X86 1
+#include <immintrin.h>
+#endif
 
-class ComputerSystem {
+#if defined(__unix__) || defined(__APPLE__)
+#define BLP_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Права субъекта к объекту - набор битов, ячейка может быть и пустой
+using Rights = uint8_t;
+const Rights kRead = 1;    // r - чтение
+const Rights kWrite = 2;   // w - запись
+const Rights kAppend = 4;  // a - дописывание
+const Rights kExecute = 8; // e - исполнение
+const char kRightLetters[] = "rwae";
+
+const Rights kAllRights = kRead | kWrite | kAppend | kExecute;
+
+// Биты прав по символу; kNoRight - символ не буква права, kDash - "-"
+const uint8_t kNoRight = 0x10;
+const uint8_t kDash = 0x20;
+
+struct RightsTable {
+    uint8_t bits[256];
+
+    constexpr RightsTable() : bits() {
+        for (size_t c = 0; c != 256; ++c) {
+            bits[c] = kNoRight;
+        }
+        for (size_t i = 0; i != 4; ++i) {
+            bits[static_cast<unsigned char>(kRightLetters[i])] = uint8_t(1) << i;
+        }
+        bits[static_cast<unsigned char>('-')] = kDash;
+    }
+};
+
+constexpr RightsTable kRightsTable;
+
+// Запись из length символов, биты которых по таблице в сумме дают bits:
+// одни буквы прав либо один "-"
+inline bool ValidRights(unsigned bits, size_t length) {
+    return (bits != 0 && bits < kNoRight) || (bits == kDash && length == 1);
+}
+
+// Права из записи вида "rw", "a" или "-" (пусто). Буквы складываются по
+// таблице без ветвлений.
+bool ParseRights(std::string_view text, Rights& rights) {
+    unsigned bits = 0;
+    for (char c : text) {
+        bits |= kRightsTable.bits[static_cast<unsigned char>(c)];
+    }
+    rights = Rights(bits & kAllRights);
+    return ValidRights(bits, text.size());
+}
+
+std::string RightsToString(Rights rights) {
+    std::string text;
+    for (size_t i = 0; i != 4; ++i) {
+        if (rights & (Rights(1) << i)) {
+            text += kRightLetters[i];
+        }
+    }
+    return text.empty() ? "-" : text;
+}
+
+// Множество категорий (до 256): бит c - категория c
+struct Categories {
+    uint64_t words[4] = {0, 0, 0, 0};
+};
+
+// Все категории b входят в a
+inline bool Contains(const Categories& a, const Categories& b) {
+    return ((b.words[0] & ~a.words[0]) | (b.words[1] & ~a.words[1]) |
+            (b.words[2] & ~a.words[2]) | (b.words[3] & ~a.words[3])) == 0;
+}
+
+inline bool operator<(const Categories& a, const Categories& b) {
+    return std::lexicographical_compare(a.words, a.words + 4, b.words, b.words + 4);
+}
+
+inline bool IsEmpty(const Categories& a) {
+    return (a.words[0] | a.words[1] | a.words[2] | a.words[3]) == 0;
+}
+
+// Метка безопасности: уровень секретности и категории. Метка a доминирует
+// метку b, если её уровень не ниже и категории b входят в категории a.
+struct Label {
+    int level = 0;
+    Categories categories;
+};
+
+inline bool Dominates(const Label& a, const Label& b) {
+    return (a.level >= b.level) & Contains(a.categories, b.categories);
+}
+
+// Метка из записи "уровень" или "уровень:категории", например 2:0,5,17
+bool ParseLabel(std::string_view text, Label& label) {
+    label = Label();
+    const char* end = text.data() + text.size();
+    const char* colon = std::find(text.data(), end, ':');
+    auto [rest, error] = std::from_chars(text.data(), colon, label.level);
+    if (error != std::errc() || rest != colon || colon == text.data()) {
+        return false;
+    }
+    if (colon != end && colon + 1 == end) {
+        return true; // "2:" - пустой список категорий
+    }
+    for (const char* p = colon; p != end;) {
+        unsigned category;
+        auto [next, failed] = std::from_chars(p + 1, end, category);
+        if (failed != std::errc() || category > 255 || (next != end && *next != ',')) {
+            return false;
+        }
+        label.categories.words[category / 64] |= uint64_t(1) << (category % 64);
+        p = next;
+    }
+    return true;
+}
+
+std::istream& operator>>(std::istream& in, Label& label) {
+    std::string text;
+    if (in >> text && !ParseLabel(text, label)) {
+        in.setstate(std::ios::failbit);
+    }
+    return in;
+}
+
+// Права, запрещённые субъекту к объекту: чтение, если субъект не доминирует
+// объект (NRU), запись и дописывание, если объект не доминирует субъект
+// (NWD). Исполнение не раскрывает и не меняет данные объекта. Запреты по
+// уровням и по категориям складываются; обе проверки без ветвлений.
+inline Rights ForbiddenRights(int subjectLevel, int objectLevel) {
+    return Rights(kRead * (objectLevel > subjectLevel) | (kWrite | kAppend) * (objectLevel < subjectLevel));
+}
+
+inline Rights ForbiddenRights(const Categories& subject, const Categories& object) {
+    return Rights(kRead * !Contains(subject, object) | (kWrite | kAppend) * !Contains(object, subject));
+}
+
+// Нарушенные права ячейки
+inline Rights ViolatedRights(Rights rights, const Label& subject, const Label& object) {
+    return rights & (ForbiddenRights(subject.level, object.level) |
+                     ForbiddenRights(subject.categories, object.categories));
+}
+
+// Метки по номерам. Уровни хранятся подряд для ядер проверки строки, а
+// множества категорий - номерами в таблице различных множеств (0 - пустое).
+// Различных множеств обычно немного, поэтому для строки субъекта один раз
+// строится таблица запретов по множествам, и проверка объекта сводится к
+// сравнению уровней и чтению таблицы.
+class LabelArray {
+private:
+    std::vector<int> levels;
+    std::vector<uint32_t> setIds;
+    std::vector<Categories> sets;
+    std::map<Categories, uint32_t> setIndex;
+    size_t categorized = 0; // меток с непустыми категориями
+
+public:
+    LabelArray(const std::vector<Label>& labels) : levels(labels.size()), setIds(labels.size(), 0), sets(1) {
+        setIndex.emplace(Categories(), 0);
+        for (size_t i = 0; i != labels.size(); ++i) {
+            Set(i, labels[i]);
+        }
+    }
+
+    Label operator[](size_t i) const {
+        return {levels[i], sets[setIds[i]]};
+    }
+
+    void Set(size_t i, const Label& label) {
+        auto it = setIndex.emplace(label.categories, static_cast<uint32_t>(sets.size())).first;
+        if (it->second == sets.size()) {
+            sets.push_back(label.categories);
+        }
+        categorized += (it->second != 0) - (setIds[i] != 0);
+        levels[i] = label.level;
+        setIds[i] = it->second;
+    }
+
+    const int* Levels() const {
+        return levels.data();
+    }
+
+    const uint32_t* SetIds() const {
+        return setIds.data();
+    }
+
+    // Таблица запретов по категориям для субъекта: права, запрещённые к
+    // объектам с каждым из множеств. false - категорий нет ни у субъекта,
+    // ни у объектов, и достаточно сравнить уровни.
+    bool Relations(const Label& subject, std::vector<int32_t>& table) const {
+        if (categorized == 0 && IsEmpty(subject.categories)) {
+            return false;
+        }
+        table.resize(sets.size());
+        for (size_t id = 0; id != sets.size(); ++id) {
+            table[id] = ForbiddenRights(subject.categories, sets[id]);
+        }
+        return true;
+    }
+
+    Rights Forbidden(size_t i, const Label& subject) const {
+        return ForbiddenRights(subject.level, levels[i]) | ForbiddenRights(subject.categories, sets[setIds[i]]);
+    }
+};
+
+// Нарушение NRU или NWD: у субъекта subject к объекту object нарушены права rights.
+// Номера с единицы, как в ComputerSystem::GetAccess.
+struct Violation {
+    size_t subject;
+    size_t object;
+    Rights rights;
+};
+
+// Номер младшего единичного бита, w != 0
+inline size_t LowestBit(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    size_t bit = 0;
+    while ((w & 1) == 0) {
+        w >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// Поиск нарушения в строке матрицы доступа субъекта уровня level, начиная
+// со столбца o: возвращает номер первого столбца с нарушением либо m.
+// sets - номера множеств категорий объектов, relation - таблица запретов
+// по множествам (LabelArray::Relations) либо nullptr, если категорий нет.
+using RowScanner = size_t (*)(const Rights* rights, const int* levels, const uint32_t* sets,
+                              const int32_t* relation, size_t m, int level, size_t o);
+
+size_t ScanRowScalar(const Rights* rights, const int* levels, const uint32_t* sets,
+                     const int32_t* relation, size_t m, int level, size_t o) {
+    if (relation == nullptr) {
+        while (o != m && (rights[o] & ForbiddenRights(level, levels[o])) == 0) {
+            ++o;
+        }
+        return o;
+    }
+    while (o != m && (rights[o] & (ForbiddenRights(level, levels[o]) | relation[sets[o]])) == 0) {
+        ++o;
+    }
+    return o;
+}
+
+#ifdef BLP_X86
+// По 4 (SSE2) и 8 (AVX2) столбцов: права расширяются до 32 бит и проверяются
+// на биты чтения и записи, уровни объектов сравниваются с уровнем субъекта,
+// размноженным по дорожкам. Запреты по категориям берутся из таблицы
+// relation (в AVX2 - одним gather на 8 столбцов) и добавляются к маскам.
+__attribute__((target("sse2")))
+size_t ScanRowSse(const Rights* rights, const int* levels, const uint32_t* sets,
+                  const int32_t* relation, size_t m, int level, size_t o) {
+    const __m128i subject = _mm_set1_epi32(level);
+    const __m128i read = _mm_set1_epi32(kRead);
+    const __m128i write = _mm_set1_epi32(kWrite | kAppend);
+    const __m128i zero = _mm_setzero_si128();
+    for (; o + 4 <= m; o += 4) {
+        int packed;
+        std::copy_n(rights + o, 4, reinterpret_cast<Rights*>(&packed));
+        __m128i cells = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        __m128i object = _mm_loadu_si128(reinterpret_cast<const __m128i*>(levels + o));
+        int reads = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(cells, read), read)));
+        int writes = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(cells, write), zero)));
+        int up = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(object, subject)));
+        int down = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(subject, object)));
+        if (relation != nullptr && (reads | writes) != 0) {
+            for (int i = 0; i != 4; ++i) {
+                int32_t forbidden = relation[sets[o + i]];
+                up |= ((forbidden & kRead) != 0) << i;
+                down |= ((forbidden & kWrite) != 0) << i;
+            }
+        }
+        if (int mask = (reads & up) | (writes & down)) {
+            return o + __builtin_ctz(mask);
+        }
+    }
+    return ScanRowScalar(rights, levels, sets, relation, m, level, o);
+}
+
+__attribute__((target("avx2")))
+size_t ScanRowAvx2(const Rights* rights, const int* levels, const uint32_t* sets,
+                   const int32_t* relation, size_t m, int level, size_t o) {
+    const __m256i subject = _mm256_set1_epi32(level);
+    const __m256i read = _mm256_set1_epi32(kRead);
+    const __m256i write = _mm256_set1_epi32(kWrite | kAppend);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; o + 8 <= m; o += 8) {
+        __m256i cells = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rights + o)));
+        __m256i object = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(levels + o));
+        int reads = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(cells, read), read)));
+        int writes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_and_si256(cells, write), zero)));
+        int up = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(object, subject)));
+        int down = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(subject, object)));
+        if (relation != nullptr && (reads | writes) != 0) {
+            __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sets + o));
+            __m256i forbidden = _mm256_i32gather_epi32(relation, ids, 4);
+            // биты чтения (1) и записи (2) сдвигаются в знаковый бит дорожки
+            up |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(forbidden, 31)));
+            down |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(forbidden, 30)));
+        }
+        if (int mask = (reads & up) | (writes & down)) {
+            return o + __builtin_ctz(mask);
+        }
+    }
+    return ScanRowSse(rights, levels, sets, relation, m, level, o);
+}
+#endif
+
+// Ядро по имени (scalar, sse, avx2) либо лучшее доступное, если имя пустое
+RowScanner SelectScanner(const std::string& name) {
+#ifdef BLP_X86
+    __builtin_cpu_init();
+    if ((name.empty() || name == "avx2") && __builtin_cpu_supports("avx2")) {
+        return ScanRowAvx2;
+    }
+    if ((name.empty() || name == "sse") && __builtin_cpu_supports("sse2")) {
+        return ScanRowSse;
+    }
+#endif
+    if (name.empty() || name == "scalar") {
+        return ScanRowScalar;
+    }
+    return nullptr;
+}
+
+RowScanner scanner = SelectScanner("");
+
+
+// Хранилища матрицы доступа. Кроме прав каждое хранит отметки нарушений
+// по ячейкам; номера субъектов и объектов здесь с нуля.
+//   CheckRow(s, subject, objects) - заново отметить нарушения строки, вернуть их число
+//   Mark(s, o, violated)       - поставить или снять отметку, вернуть изменение числа нарушений
+//   ForEachInRow(s, visit)     - visit(o, rights) для непустых ячеек строки
+//   ForEachInColumn(o, visit)  - visit(s, rights) для непустых ячеек столбца
+//   ForEachMarked(s, visit)    - visit(o, rights) для отмеченных ячеек строки
+
+// Плотная матрица: n * m прав построчно и бит отметки на ячейку
+class DenseMatrix {
+private:
+    size_t rows, columns;
+    size_t words; // слов отметок на строку
+    std::vector<Rights> cells;
+    std::vector<uint64_t> marks;
+
+public:
+    DenseMatrix(size_t n, size_t m) : rows(n), columns(m), words((m + 63) / 64),
+                                      cells(n * m, 0), marks(n * words, 0) {}
+
+    Rights Get(size_t s, size_t o) const {
+        return cells[s * columns + o];
+    }
+
+    void Set(size_t s, size_t o, Rights rights) {
+        cells[s * columns + o] = rights;
+    }
+
+    // Строка прав подряд - для загрузки и сохранения целиком
+    Rights* Row(size_t s) {
+        return cells.data() + s * columns;
+    }
+
+    const Rights* Row(size_t s) const {
+        return cells.data() + s * columns;
+    }
+
+    size_t CheckRow(size_t s, const Label& subject, const LabelArray& objects) {
+        const Rights* row = cells.data() + s * columns;
+        std::vector<int32_t> table;
+        const int32_t* relation = objects.Relations(subject, table) ? table.data() : nullptr;
+        uint64_t* bits = marks.data() + s * words;
+        std::fill_n(bits, words, 0);
+        size_t count = 0;
+        for (size_t o = 0; (o = scanner(row, objects.Levels(), objects.SetIds(), relation, columns, subject.level, o)) != columns; ++o) {
+            bits[o / 64] |= uint64_t(1) << (o % 64);
+            ++count;
+        }
+        return count;
+    }
+
+    int Mark(size_t s, size_t o, bool violated) {
+        uint64_t& word = marks[s * words + o / 64];
+        uint64_t bit = uint64_t(1) << (o % 64);
+        if (((word & bit) != 0) == violated) {
+            return 0;
+        }
+        word ^= bit;
+        return violated ? 1 : -1;
+    }
+
+    template <typename Visitor>
+    void ForEachInRow(size_t s, Visitor visit) const {
+        for (size_t o = 0; o != columns; ++o) {
+            if (Rights rights = cells[s * columns + o]) {
+                visit(o, rights);
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void ForEachInColumn(size_t o, Visitor visit) const {
+        for (size_t s = 0; s != rows; ++s) {
+            if (Rights rights = cells[s * columns + o]) {
+                visit(s, rights);
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void ForEachMarked(size_t s, Visitor visit) const {
+        for (size_t w = 0; w != words; ++w) {
+            for (uint64_t bits = marks[s * words + w]; bits != 0; bits &= bits - 1) {
+                size_t o = w * 64 + LowestBit(bits);
+                visit(o, cells[s * columns + o]);
+            }
+        }
+    }
+};
+
+// Разреженная матрица: у субъекта упорядоченный список непустых ячеек,
+// у объекта - список субъектов с правами к нему. Память O(n + m + ячеек).
+class SparseMatrix {
+private:
+    struct Cell {
+        uint32_t object;
+        Rights rights;
+        bool violated;
+    };
+
+    std::vector<std::vector<Cell>> rows;
+    std::vector<std::vector<uint32_t>> columns;
+
+    static bool Less(const Cell& cell, size_t o) {
+        return cell.object < o;
+    }
+
+    std::vector<Cell>::iterator Find(size_t s, size_t o) {
+        return std::lower_bound(rows[s].begin(), rows[s].end(), o, Less);
+    }
+
+public:
+    SparseMatrix(size_t n, size_t m) : rows(n), columns(m) {}
+
+    Rights Get(size_t s, size_t o) const {
+        auto it = std::lower_bound(rows[s].begin(), rows[s].end(), o, Less);
+        return it != rows[s].end() && it->object == o ? it->rights : 0;
+    }
+
+    void Set(size_t s, size_t o, Rights rights) {
+        auto it = Find(s, o);
+        bool present = it != rows[s].end() && it->object == o;
+        if (present && rights != 0) {
+            it->rights = rights;
+        } else if (present) {
+            rows[s].erase(it);
+            auto& column = columns[o];
+            *std::find(column.begin(), column.end(), s) = column.back();
+            column.pop_back();
+        } else if (rights != 0) {
+            rows[s].insert(it, {static_cast<uint32_t>(o), rights, false});
+            columns[o].push_back(static_cast<uint32_t>(s));
+        }
+    }
+
+    size_t CheckRow(size_t s, const Label& subject, const LabelArray& objects) {
+        size_t count = 0;
+        for (Cell& cell : rows[s]) {
+            cell.violated = (cell.rights & objects.Forbidden(cell.object, subject)) != 0;
+            count += cell.violated;
+        }
+        return count;
+    }
+
+    int Mark(size_t s, size_t o, bool violated) {
+        auto it = Find(s, o);
+        if (it == rows[s].end() || it->object != o || it->violated == violated) {
+            return 0;
+        }
+        it->violated = violated;
+        return violated ? 1 : -1;
+    }
+
+    template <typename Visitor>
+    void ForEachInRow(size_t s, Visitor visit) const {
+        for (const Cell& cell : rows[s]) {
+            visit(cell.object, cell.rights);
+        }
+    }
+
+    template <typename Visitor>
+    void ForEachInColumn(size_t o, Visitor visit) const {
+        for (uint32_t s : columns[o]) {
+            visit(s, Get(s, o));
+        }
+    }
+
+    template <typename Visitor>
+    void ForEachMarked(size_t s, Visitor visit) const {
+        for (const Cell& cell : rows[s]) {
+            if (cell.violated) {
+                visit(cell.object, cell.rights);
+            }
+        }
+    }
+};
+
+
+// Изменения (SetAccess, SetSubjectLevel, SetObjectLevel) ведут учёт текущих
+// нарушений: отметки в ячейках хранилища и счётчики по строкам. Поэтому
+// проверка безопасности после каждого изменения стоит O(1), а само
+// изменение - O(1) для ячейки, строка для уровня субъекта и столбец для
+// уровня объекта.
+template <typename Matrix>
+class BasicComputerSystem {
 private:
     size_t subjectsNumber, objectsNumber;
-    std::vector<std::vector<char>> accessMatrix;
-    std::vector<int> subjectsLevels;
-    std::vector<int> objectsLevels;
+    Matrix accessMatrix;
+    LabelArray subjectsLevels;
+    LabelArray objectsLevels;
+    std::vector<size_t> rowViolations;
+    size_t violationsNumber = 0;
+
+    void Mark(size_t s, size_t o, Rights rights) {
+        int delta = accessMatrix.Mark(s, o, (rights & objectsLevels.Forbidden(o, subjectsLevels[s])) != 0);
+        rowViolations[s] += delta;
+        violationsNumber += delta;
+    }
+
+    void Audit(size_t threads);
 public:
-    ComputerSystem(size_t n, size_t m, std::vector<std::vector<char>> A, std::vector<int> LS, std::vector<int> LO) {
-        subjectsNumber = n;
-        objectsNumber = m;
-        accessMatrix = A;
-        subjectsLevels = LS;
-        objectsLevels = LO;
+    BasicComputerSystem(Matrix A, const std::vector<Label>& LS, const std::vector<Label>& LO, size_t threads = 1)
+        : accessMatrix(std::move(A)), subjectsLevels(LS), objectsLevels(LO) {
+        subjectsNumber = LS.size();
+        objectsNumber = LO.size();
+        Audit(threads);
     }
 
-    int GetObjectLevel(size_t object) const {
+    Label GetObjectLevel(size_t object) const {
         return objectsLevels[object - 1];   
     }
 
-    int GetSubjectLevel(size_t subject) const {
+    Label GetSubjectLevel(size_t subject) const {
         return subjectsLevels[subject - 1];
     }
 
-    char GetAccess(size_t subject, size_t object) const {
-        return accessMatrix[subject - 1][object - 1];
+    Rights GetAccess(size_t subject, size_t object) const {
+        return accessMatrix.Get(subject - 1, object - 1);
     }
 
     size_t subjects() const {
@@ -37,9 +582,56 @@ public:
         return objectsNumber;
     }
 
-    bool IsSafe() const;
+    // Старая отметка снимается до записи: разреженное хранилище удаляет
+    // ячейку вместе с отметкой, когда права становятся пустыми
+    void SetAccess(size_t subject, size_t object, Rights rights) {
+        Mark(subject - 1, object - 1, 0);
+        accessMatrix.Set(subject - 1, object - 1, rights);
+        Mark(subject - 1, object - 1, rights);
+    }
+
+    void SetSubjectLevel(size_t subject, const Label& level) {
+        subjectsLevels.Set(subject - 1, level);
+        violationsNumber -= rowViolations[subject - 1];
+        rowViolations[subject - 1] = accessMatrix.CheckRow(subject - 1, level, objectsLevels);
+        violationsNumber += rowViolations[subject - 1];
+    }
+
+    void SetObjectLevel(size_t object, const Label& level) {
+        objectsLevels.Set(object - 1, level);
+        accessMatrix.ForEachInColumn(object - 1, [this, object](size_t s, Rights rights) {
+            Mark(s, object - 1, rights);
+        });
+    }
+
+    // Критерий безопасности системы:
+    // безопасны все достижимые состояния системы
+    // (состояние безопасно если выполнено NRU и NWD)
+    bool IsSafe() const {
+        return violationsNumber == 0;
+    }
+
+    size_t GetViolationsNumber() const {
+        return violationsNumber;
+    }
+
+    // Все нарушения построчно
+    std::vector<Violation> FindViolations() const;
+
+    // visit(subject, object, rights) для всех непустых ячеек построчно
+    template <typename Visitor>
+    void ForEachAccess(Visitor visit) const {
+        for (size_t s = 0; s != subjectsNumber; ++s) {
+            accessMatrix.ForEachInRow(s, [&](size_t o, Rights rights) {
+                visit(s + 1, o + 1, rights);
+            });
+        }
+    }
 };
 
+using ComputerSystem = BasicComputerSystem<DenseMatrix>;
+using SparseComputerSystem = BasicComputerSystem<SparseMatrix>;
+
 
 template <typename T>
 void EnterArray(size_t length, std::vector<T>& saveTo) {
@@ -53,70 +645,889 @@ void EnterArray(size_t length, std::vector<T>& saveTo) {
 }
 
 
-template <typename T>
-void EnterMatrix(size_t rows, size_t columns, std::vector<std::vector<T>>& saveTo) {
-    saveTo.clear();
-    saveTo.reserve(rows);
-    while (rows--) {
-        std::vector<T> row;
-        EnterArray(columns, row);
-        saveTo.push_back(row);
+// Права разбираются сразу в плотную матрицу, без второй копии в строках
+bool EnterMatrix(size_t rows, size_t columns, DenseMatrix& matrix) {
+    std::string text;
+    for (size_t s = 0; s != rows; ++s) {
+        for (size_t o = 0; o != columns; ++o) {
+            Rights rights;
+            if (!(std::cin >> text) || !ParseRights(text, rights)) {
+                std::cerr << "invalid rights " << text << '\n';
+                return false;
+            }
+            matrix.Set(s, o, rights);
+        }
     }
+    return true;
 }
 
 
-template <typename T>
-void PrintMatrix(const std::vector<std::vector<T>> matrix) {
-    for (size_t i = 0; i != matrix.size(); ++i) {
-        for (const T& el : matrix[i]) {
-            std::cout << el << ' ';
+void PrintMatrix(size_t rows, size_t columns, const DenseMatrix& matrix) {
+    std::string line;
+    for (size_t s = 0; s != rows; ++s) {
+        line.clear();
+        for (size_t o = 0; o != columns; ++o) {
+            line += RightsToString(matrix.Get(s, o));
+            line += ' ';
         }
-        std::cout << '\n';
+        std::cout << line << '\n';
     }
 }
 
-// Критерий безопасности системы:
-// безопасны все достижимые состояния системы
-// (состояние безопасно если выполнено NRU и NWD)
-bool ComputerSystem::IsSafe() const {
-    for (size_t s = 1; s != subjects() + 1; ++s) {
-        for (size_t o = 1; o != objects() + 1; ++o) {
-            char access = GetAccess(s, o);
-            if (access == 'r') {
-                if (GetSubjectLevel(s) < GetObjectLevel(o)) {
-                    return false;
+// Полная проверка: строки делятся на threads подряд идущих блоков, строки
+// хранилища независимы, так что потоки не пересекаются
+template <typename Matrix>
+void BasicComputerSystem<Matrix>::Audit(size_t threads) {
+    rowViolations.assign(subjectsNumber, 0);
+    threads = std::max<size_t>(1, std::min(threads, subjectsNumber));
+    size_t block = (subjectsNumber + threads - 1) / threads;
+    auto check = [this](size_t begin, size_t end) {
+        for (size_t s = begin; s != end; ++s) {
+            rowViolations[s] = accessMatrix.CheckRow(s, subjectsLevels[s], objectsLevels);
+        }
+    };
+    if (threads == 1) {
+        check(0, subjectsNumber);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t != threads; ++t) {
+            size_t begin = std::min(subjectsNumber, t * block), end = std::min(subjectsNumber, begin + block);
+            workers.emplace_back(check, begin, end);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    violationsNumber = 0;
+    for (size_t count : rowViolations) {
+        violationsNumber += count;
+    }
+}
+
+template <typename Matrix>
+std::vector<Violation> BasicComputerSystem<Matrix>::FindViolations() const {
+    std::vector<Violation> found;
+    found.reserve(violationsNumber);
+    for (size_t s = 0; s != subjectsNumber; ++s) {
+        if (rowViolations[s] == 0) {
+            continue;
+        }
+        accessMatrix.ForEachMarked(s, [&](size_t o, Rights rights) {
+            found.push_back({s + 1, o + 1, ViolatedRights(rights, subjectsLevels[s], objectsLevels[o])});
+        });
+    }
+    return found;
+}
+
+
+// Утечка: информация объекта from по цепочке чтений и записей доходит до
+// объекта to, метка которого не доминирует метку from. Номера с единицы.
+struct Leak {
+    size_t from;
+    size_t to;
+};
+
+// Граф потоков информации: чтение - дуга от объекта к субъекту, запись и
+// дописывание - от субъекта к объекту. Вершины 0..n-1 - субъекты,
+// n..n+m-1 - объекты. Граф сжимается по компонентам сильной связности,
+// затем для каждой компоненты собирается битовое множество объектов,
+// достижимых из неё непустым путём: компоненты без дуг между собой
+// (одинаковой высоты над стоками) обрабатываются потоками по блокам.
+// Множества компонент без объектов освобождаются, как только учтены во
+// всех предшественниках, так что память - O(m * m / 8) байт на замыкание
+// объектов.
+class InformationFlow {
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    size_t subjectsNumber, objectsNumber;
+    size_t words; // слов на множество объектов
+    std::vector<Label> objectsLevels;
+    std::vector<size_t> first; // дуги вершины v - targets[first[v]..first[v + 1])
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> component;   // номера в обратном топологическом порядке
+    std::vector<size_t> memberFirst;   // вершины компоненты c - members[memberFirst[c]..memberFirst[c + 1])
+    std::vector<uint32_t> members;
+    std::vector<std::vector<uint64_t>> reach; // пусто - из компоненты объекты недостижимы
+
+    void Condense();
+    void Close(size_t threads);
+public:
+    template <typename System>
+    InformationFlow(const System& cs, size_t threads = 1);
+
+    size_t subjects() const {
+        return subjectsNumber;
+    }
+
+    size_t objects() const {
+        return objectsNumber;
+    }
+
+    // Утечки из объектов from, from + 1, ... по возрастанию (from, to), пока
+    // в leaks не наберётся limit: источники берутся целиком. Результат -
+    // первый непросмотренный источник, objects() + 1 - просмотрены все.
+    size_t FindLeaks(size_t from, size_t limit, std::vector<Leak>& leaks) const;
+
+    // Дерево кратчайших путей из объекта from: предок каждой вершины.
+    // Обход останавливается, как только найдены leaks объектов, метки
+    // которых не доминируют метку from.
+    std::vector<uint32_t> PathTree(size_t from, size_t leaks) const;
+
+    // Промежуточные вершины пути до объекта to по дереву PathTree
+    std::vector<uint32_t> Path(const std::vector<uint32_t>& tree, size_t to) const;
+};
+
+template <typename System>
+InformationFlow::InformationFlow(const System& cs, size_t threads)
+    : subjectsNumber(cs.subjects()), objectsNumber(cs.objects()), words((cs.objects() + 63) / 64) {
+    size_t n = subjectsNumber;
+    for (size_t o = 1; o != objectsNumber + 1; ++o) {
+        objectsLevels.push_back(cs.GetObjectLevel(o));
+    }
+    first.assign(n + objectsNumber + 1, 0);
+    cs.ForEachAccess([&](size_t s, size_t o, Rights rights) {
+        first[s - 1] += (rights & (kWrite | kAppend)) != 0;
+        first[n + o - 1] += (rights & kRead) != 0;
+    });
+    for (size_t v = 1; v != first.size(); ++v) {
+        first[v] += first[v - 1];
+    }
+    targets.resize(first.back());
+    // Заполнение с конца: после него first[v] снова указывает на начало дуг v
+    cs.ForEachAccess([&](size_t s, size_t o, Rights rights) {
+        if (rights & (kWrite | kAppend)) {
+            targets[--first[s - 1]] = static_cast<uint32_t>(n + o - 1);
+        }
+        if (rights & kRead) {
+            targets[--first[n + o - 1]] = static_cast<uint32_t>(s - 1);
+        }
+    });
+    Condense();
+    Close(threads);
+}
+
+// Тарьян без рекурсии: компонента получает номер, когда закрыты все
+// достижимые из неё, поэтому номера идут от стоков к истокам
+void InformationFlow::Condense() {
+    size_t vertices = first.size() - 1;
+    std::vector<uint32_t> index(vertices, kNone), low(vertices);
+    std::vector<uint32_t> stack;
+    std::vector<bool> onStack(vertices, false);
+    std::vector<std::pair<uint32_t, size_t>> calls; // вершина и её следующая дуга
+    component.assign(vertices, kNone);
+    uint32_t counter = 0, components = 0;
+    auto enter = [&](uint32_t v) {
+        index[v] = low[v] = counter++;
+        stack.push_back(v);
+        onStack[v] = true;
+        calls.push_back({v, first[v]});
+    };
+    for (uint32_t root = 0; root != vertices; ++root) {
+        if (index[root] != kNone) {
+            continue;
+        }
+        enter(root);
+        while (!calls.empty()) {
+            uint32_t v = calls.back().first;
+            size_t& e = calls.back().second;
+            if (e != first[v + 1]) {
+                uint32_t t = targets[e++];
+                if (index[t] == kNone) {
+                    enter(t);
+                } else if (onStack[t]) {
+                    low[v] = std::min(low[v], index[t]);
                 }
-            } else if (access == 'w') {
-                if (GetSubjectLevel(s) > GetObjectLevel(o)) {
-                    return false;
+                continue;
+            }
+            calls.pop_back();
+            if (!calls.empty()) {
+                uint32_t parent = calls.back().first;
+                low[parent] = std::min(low[parent], low[v]);
+            }
+            if (low[v] == index[v]) {
+                uint32_t u;
+                do {
+                    u = stack.back();
+                    stack.pop_back();
+                    onStack[u] = false;
+                    component[u] = components;
+                } while (u != v);
+                ++components;
+            }
+        }
+    }
+
+    memberFirst.assign(components + 1, 0);
+    for (uint32_t c : component) {
+        ++memberFirst[c + 1];
+    }
+    for (size_t c = 1; c != memberFirst.size(); ++c) {
+        memberFirst[c] += memberFirst[c - 1];
+    }
+    members.resize(vertices);
+    std::vector<size_t> next(memberFirst.begin(), memberFirst.end() - 1);
+    for (uint32_t v = 0; v != vertices; ++v) {
+        members[next[component[v]]++] = v;
+    }
+}
+
+void InformationFlow::Close(size_t threads) {
+    size_t components = memberFirst.size() - 1;
+    size_t n = subjectsNumber;
+    // Высота компоненты над стоками и число дуг в неё из других компонент
+    std::vector<uint32_t> height(components, 0);
+    std::vector<std::atomic<uint32_t>> pending(components);
+    std::vector<bool> hasObjects(components, false);
+    for (size_t c = 0; c != components; ++c) {
+        for (size_t i = memberFirst[c]; i != memberFirst[c + 1]; ++i) {
+            uint32_t v = members[i];
+            hasObjects[c] = hasObjects[c] || v >= n;
+            for (size_t e = first[v]; e != first[v + 1]; ++e) {
+                uint32_t d = component[targets[e]];
+                if (d != c) {
+                    height[c] = std::max(height[c], height[d] + 1);
+                    ++pending[d];
                 }
-            } else {
-                return false;
             }
         }
     }
-    return true;
+    std::vector<uint32_t> order(components);
+    for (uint32_t c = 0; c != components; ++c) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&height](uint32_t a, uint32_t b) {
+        return height[a] < height[b];
+    });
+
+    reach.assign(components, {});
+    auto close = [&](uint32_t c) {
+        std::vector<uint64_t> bits;
+        for (size_t i = memberFirst[c]; i != memberFirst[c + 1]; ++i) {
+            uint32_t v = members[i];
+            for (size_t e = first[v]; e != first[v + 1]; ++e) {
+                uint32_t t = targets[e], d = component[t];
+                if (t >= n || (d != c && !reach[d].empty())) {
+                    bits.resize(words, 0);
+                }
+                if (t >= n) {
+                    bits[(t - n) / 64] |= uint64_t(1) << ((t - n) % 64);
+                }
+                if (d == c) {
+                    continue;
+                }
+                const std::vector<uint64_t>& next = reach[d];
+                for (size_t w = 0; w != next.size(); ++w) {
+                    bits[w] |= next[w];
+                }
+                if (!hasObjects[d] && --pending[d] == 0) {
+                    std::vector<uint64_t>().swap(reach[d]);
+                }
+            }
+        }
+        reach[c] = std::move(bits);
+    };
+
+    // Одна высота - один шаг: её компоненты зависят только от более низких
+    threads = std::max<size_t>(1, threads);
+    for (size_t begin = 0, end; begin != components; begin = end) {
+        end = begin;
+        while (end != components && height[order[end]] == height[order[begin]]) {
+            ++end;
+        }
+        size_t count = end - begin;
+        size_t workers = std::min(threads, count / 64 + 1);
+        if (workers == 1) {
+            for (size_t i = begin; i != end; ++i) {
+                close(order[i]);
+            }
+            continue;
+        }
+        size_t block = (count + workers - 1) / workers;
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t != workers; ++t) {
+            size_t from = std::min(end, begin + t * block), to = std::min(end, from + block);
+            pool.emplace_back([&close, &order, from, to] {
+                for (size_t i = from; i != to; ++i) {
+                    close(order[i]);
+                }
+            });
+        }
+        for (auto& worker : pool) {
+            worker.join();
+        }
+    }
+}
+
+size_t InformationFlow::FindLeaks(size_t from, size_t limit, std::vector<Leak>& leaks) const {
+    size_t a = from - 1;
+    for (; a != objectsNumber && leaks.size() < limit; ++a) {
+        const std::vector<uint64_t>& bits = reach[component[subjectsNumber + a]];
+        for (size_t w = 0; w != bits.size(); ++w) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                size_t b = w * 64 + LowestBit(word);
+                if (!Dominates(objectsLevels[b], objectsLevels[a])) {
+                    leaks.push_back({a + 1, b + 1});
+                }
+            }
+        }
+    }
+    return a + 1;
+}
+
+std::vector<uint32_t> InformationFlow::PathTree(size_t from, size_t leaks) const {
+    std::vector<uint32_t> tree(first.size() - 1, kNone);
+    std::vector<uint32_t> queue;
+    uint32_t root = static_cast<uint32_t>(subjectsNumber + from - 1);
+    tree[root] = root;
+    queue.push_back(root);
+    for (size_t head = 0; head != queue.size() && leaks != 0; ++head) {
+        uint32_t v = queue[head];
+        for (size_t e = first[v]; e != first[v + 1]; ++e) {
+            uint32_t t = targets[e];
+            if (tree[t] != kNone) {
+                continue;
+            }
+            tree[t] = v;
+            queue.push_back(t);
+            if (t >= subjectsNumber && !Dominates(objectsLevels[t - subjectsNumber], objectsLevels[from - 1])) {
+                --leaks;
+            }
+        }
+    }
+    return tree;
+}
+
+std::vector<uint32_t> InformationFlow::Path(const std::vector<uint32_t>& tree, size_t to) const {
+    std::vector<uint32_t> path;
+    uint32_t v = static_cast<uint32_t>(subjectsNumber + to - 1);
+    while (tree[v] != v) {
+        v = tree[v];
+        path.push_back(v);
+    }
+    path.pop_back();
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+
+void PrintViolations(const std::vector<Violation>& violations) {
+    for (const auto& v : violations) {
+        std::cout << "subject " << v.subject << " object " << v.object
+                  << " access " << RightsToString(v.rights) << '\n';
+    }
+}
+
+// Утечки с путём для каждой: одно дерево путей на объект-источник, деревья
+// строятся потоками по блокам источников, вывод - в исходном порядке
+void PrintLeakPaths(const InformationFlow& flow, const std::vector<Leak>& leaks, size_t threads) {
+    std::vector<size_t> groups; // начала групп утечек одного источника
+    for (size_t i = 0; i != leaks.size(); ++i) {
+        if (i == 0 || leaks[i].from != leaks[i - 1].from) {
+            groups.push_back(i);
+        }
+    }
+    groups.push_back(leaks.size());
+    size_t sources = groups.size() - 1;
+    threads = std::max<size_t>(1, std::min(threads, sources));
+    size_t block = (sources + threads - 1) / threads;
+    std::vector<std::string> text(threads);
+    auto describe = [&](size_t begin, size_t end, std::string& out) {
+        for (size_t g = begin; g != end; ++g) {
+            std::vector<uint32_t> tree = flow.PathTree(leaks[groups[g]].from, groups[g + 1] - groups[g]);
+            for (size_t i = groups[g]; i != groups[g + 1]; ++i) {
+                out += "leak object " + std::to_string(leaks[i].from) + " -> object " + std::to_string(leaks[i].to) + " via";
+                const char* separator = " ";
+                for (uint32_t v : flow.Path(tree, leaks[i].to)) {
+                    if (v < flow.subjects()) {
+                        out += separator + ("subject " + std::to_string(v + 1));
+                    } else {
+                        out += separator + ("object " + std::to_string(v - flow.subjects() + 1));
+                    }
+                    separator = ", ";
+                }
+                out += '\n';
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t != threads; ++t) {
+        size_t begin = std::min(sources, t * block), end = std::min(sources, begin + block);
+        if (threads == 1) {
+            describe(begin, end, text[t]);
+        } else {
+            workers.emplace_back(describe, begin, end, std::ref(text[t]));
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const std::string& part : text) {
+        std::cout << part;
+    }
+}
+
+// Утечек может быть порядка m * m, поэтому они не копятся целиком: источники
+// идут блоками примерно по kBlockLeaks утечек, блок печатается и
+// освобождается, для итога остаётся только счётчик
+void PrintLeaks(const InformationFlow& flow, size_t threads) {
+    const size_t kBlockLeaks = 1 << 20;
+    std::vector<Leak> leaks;
+    uint64_t total = 0;
+    for (size_t from = 1; from <= flow.objects(); ) {
+        leaks.clear();
+        from = flow.FindLeaks(from, kBlockLeaks, leaks);
+        PrintLeakPaths(flow, leaks, threads);
+        total += leaks.size();
+    }
+    std::cout << total << " leak(s)" << '\n';
+}
+
+// Загрузка политики из файла без диалога и эха. Файл отображается в память
+// и разбирается потоками по частям прямо в плотную матрицу.
+// Текстовый формат - тот же, что при вводе с клавиатуры: "n m", n * m прав
+// построчно, n меток субъектов и m меток объектов через любые пробелы.
+// Двоичный - kPolicyMagic, n и m (uint64), n * m байт прав построчно, затем
+// n + m меток: уровень (int32) и четыре слова категорий (uint64). Числа в
+// порядке байт машины, на которой файл записан.
+const char kPolicyMagic[] = "BLP1";
+const size_t kPolicyLabel = sizeof(int32_t) + sizeof(Categories::words);
+
+struct Policy {
+    DenseMatrix matrix;
+    std::vector<Label> subjects;
+    std::vector<Label> objects;
+};
+
+// Содержимое файла: отображение в память, а без POSIX - прочитанная копия
+struct FileData {
+    std::shared_ptr<const char> mapping;
+    size_t length = 0;
+    std::string copy;
+
+    std::string_view View() const {
+        return mapping ? std::string_view(mapping.get(), length) : std::string_view(copy);
+    }
+};
+
+std::optional<FileData> ReadFile(const std::string& path) {
+    FileData file;
+#ifdef BLP_POSIX
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return std::nullopt;
+    }
+    size_t length = info.st_size;
+    void* base = length == 0 ? MAP_FAILED : mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (length != 0 && base == MAP_FAILED) {
+        return std::nullopt;
+    }
+    if (length != 0) {
+        madvise(base, length, MADV_WILLNEED); // потоки читают разные части сразу
+        file.mapping.reset(static_cast<const char*>(base), [length](const char* p) {
+            munmap(const_cast<char*>(p), length);
+        });
+        file.length = length;
+    }
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    file.copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+#endif
+    return file;
+}
+
+// work(t, begin, end) для threads подряд идущих блоков [0, count)
+template <typename Work>
+void ForEachBlock(size_t count, size_t threads, Work work) {
+    threads = std::max<size_t>(1, std::min(threads, count));
+    size_t block = (count + threads - 1) / threads;
+    if (threads == 1) {
+        work(0, 0, count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t != threads; ++t) {
+        size_t begin = std::min(count, t * block), end = std::min(count, begin + block);
+        workers.emplace_back(work, t, begin, end);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Пробел, табуляция или перевод строки; без ветвлений
+inline bool IsSpace(char c) {
+    return (c == ' ') | (static_cast<unsigned char>(c - '\t') <= '\r' - '\t');
+}
+
+// Число слов в [begin, end): мест, где за пробелом (или началом) идёт не
+// пробел. С SSE2 по 16 символов: маска пробелов, сдвинутая на символ, даёт
+// начала слов.
+size_t CountWords(const char* begin, const char* end) {
+    size_t count = 0;
+    bool space = true;
+#ifdef BLP_X86
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    uint32_t carry = 1;
+    for (; end - begin >= 16; begin += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i shifted = _mm_sub_epi8(v, tab);
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+        uint32_t spaces = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, blank), control));
+        count += __builtin_popcount(~spaces & (spaces << 1 | carry) & 0xFFFF);
+        carry = spaces >> 15;
+    }
+    space = carry;
+#endif
+    for (; begin != end; ++begin) {
+        bool current = IsSpace(*begin);
+        count += space & !current;
+        space = current;
+    }
+    return count;
+}
+
+// Текст: заголовок читается сразу, остальное делится на части по пробелам
+// так, чтобы слово не разрывалось. Первый проход считает слова в частях,
+// второй по номеру слова знает его место - ячейку или метку - и пишет без
+// синхронизации: части не пересекаются.
+std::optional<Policy> ParseTextPolicy(const std::string& path, std::string_view data, size_t threads) {
+    const size_t kMinChunk = 1 << 16; // меньшие части дешевле разобрать одним потоком
+    const char* end = data.data() + data.size();
+    const char* pos = data.data();
+    size_t sizes[2];
+    for (size_t& size : sizes) {
+        while (pos != end && IsSpace(*pos)) {
+            ++pos;
+        }
+        auto [next, error] = std::from_chars(pos, end, size);
+        if (error != std::errc() || size > UINT32_MAX) {
+            std::cerr << path << ": bad size at offset " << pos - data.data() << '\n';
+            return std::nullopt;
+        }
+        pos = next;
+    }
+    size_t n = sizes[0], m = sizes[1], cells = n * m, total = cells + n + m;
+    std::string_view body(pos, end - pos);
+    if ((body.size() + 1) / 2 < total) { // на слово хотя бы символ и пробел
+        std::cerr << path << ": expected " << total << " entries" << '\n';
+        return std::nullopt;
+    }
+
+    size_t chunks = std::max<size_t>(1, std::min(threads, body.size() / kMinChunk));
+    std::vector<size_t> bounds(chunks + 1, body.size());
+    bounds[0] = 0;
+    for (size_t c = 1; c != chunks; ++c) {
+        size_t b = std::max(bounds[c - 1], c * (body.size() / chunks));
+        while (b != body.size() && !IsSpace(body[b])) {
+            ++b;
+        }
+        bounds[c] = b;
+    }
+    std::vector<size_t> first(chunks + 1, 0);
+    ForEachBlock(chunks, chunks, [&](size_t, size_t begin, size_t finish) {
+        for (size_t c = begin; c != finish; ++c) {
+            first[c + 1] = CountWords(body.data() + bounds[c], body.data() + bounds[c + 1]);
+        }
+    });
+    for (size_t c = 0; c != chunks; ++c) {
+        first[c + 1] += first[c];
+    }
+    if (first[chunks] != total) {
+        std::cerr << path << ": expected " << total << " entries, found " << first[chunks] << '\n';
+        return std::nullopt;
+    }
+
+    Policy policy{DenseMatrix(n, m), std::vector<Label>(n), std::vector<Label>(m)};
+    std::vector<size_t> errors(chunks, SIZE_MAX); // смещение первого неверного слова части
+    ForEachBlock(chunks, chunks, [&](size_t, size_t begin, size_t finish) {
+        for (size_t c = begin; c != finish; ++c) {
+            // Запись байта прав может менять что угодно, поэтому всё нужное
+            // циклу - в локальных переменных, а не в захваченных по ссылке
+            Rights* out = policy.matrix.Row(0); // строки лежат подряд, ячейка k - out[k]
+            const char* text = body.data();
+            const size_t limit = cells;
+            size_t k = first[c];
+            for (size_t i = bounds[c], stop = bounds[c + 1];; ++k) {
+                while (i != stop && IsSpace(text[i])) {
+                    ++i;
+                }
+                if (i == stop) {
+                    break;
+                }
+                size_t start = i;
+                bool valid;
+                if (k < limit) {
+                    unsigned bits = 0;
+                    for (; i != stop && !IsSpace(text[i]); ++i) {
+                        bits |= kRightsTable.bits[static_cast<unsigned char>(text[i])];
+                    }
+                    out[k] = Rights(bits & kAllRights);
+                    valid = ValidRights(bits, i - start);
+                } else {
+                    while (i != stop && !IsSpace(text[i])) {
+                        ++i;
+                    }
+                    Label& label = k < cells + n ? policy.subjects[k - cells] : policy.objects[k - cells - n];
+                    valid = ParseLabel(body.substr(start, i - start), label);
+                }
+                if (!valid) {
+                    errors[c] = start;
+                    break;
+                }
+            }
+        }
+    });
+    size_t error = *std::min_element(errors.begin(), errors.end());
+    if (error != SIZE_MAX) {
+        size_t length = std::find_if(body.begin() + error, body.end(), IsSpace) - (body.begin() + error);
+        std::cerr << path << ": bad entry " << body.substr(error, length) << " at offset "
+                  << error + (body.data() - data.data()) << '\n';
+        return std::nullopt;
+    }
+    return policy;
+}
+
+// Двоичный файл: строки прав копируются потоками с проверкой лишних битов
+std::optional<Policy> ParseBinaryPolicy(const std::string& path, std::string_view data, size_t threads) {
+    const size_t kHeader = sizeof(kPolicyMagic) - 1 + 2 * sizeof(uint64_t);
+    uint64_t sizes[2] = {0, 0};
+    if (data.size() >= kHeader) {
+        std::memcpy(sizes, data.data() + sizeof(kPolicyMagic) - 1, sizeof(sizes));
+    }
+    size_t n = sizes[0], m = sizes[1];
+    if (data.size() < kHeader || n > UINT32_MAX || m > UINT32_MAX ||
+        (data.size() - kHeader) / (m + kPolicyLabel) < n ||
+        data.size() - kHeader != n * m + (n + m) * kPolicyLabel) {
+        std::cerr << path << ": bad size" << '\n';
+        return std::nullopt;
+    }
+    Policy policy{DenseMatrix(n, m), std::vector<Label>(n), std::vector<Label>(m)};
+    const char* cells = data.data() + kHeader;
+    std::atomic<size_t> bad(SIZE_MAX);
+    ForEachBlock(n, threads, [&](size_t, size_t begin, size_t end) {
+        for (size_t s = begin; s != end; ++s) {
+            Rights* row = policy.matrix.Row(s);
+            std::memcpy(row, cells + s * m, m);
+            uint8_t extra = 0;
+            for (size_t o = 0; o != m; ++o) {
+                extra |= row[o];
+            }
+            if (extra & ~kAllRights) {
+                size_t expected = bad.load();
+                while (s < expected && !bad.compare_exchange_weak(expected, s)) {
+                }
+                return;
+            }
+        }
+    });
+    if (bad.load() != SIZE_MAX) {
+        std::cerr << path << ": bad rights in row " << bad.load() + 1 << '\n';
+        return std::nullopt;
+    }
+    const char* labels = cells + n * m;
+    for (size_t i = 0; i != n + m; ++i, labels += kPolicyLabel) {
+        Label& label = i < n ? policy.subjects[i] : policy.objects[i - n];
+        int32_t level;
+        std::memcpy(&level, labels, sizeof(level));
+        std::memcpy(label.categories.words, labels + sizeof(level), sizeof(label.categories.words));
+        label.level = level;
+    }
+    return policy;
+}
+
+// Формат определяется по заголовку
+std::optional<Policy> LoadPolicy(const std::string& path, size_t threads) {
+    std::optional<FileData> file = ReadFile(path);
+    if (!file) {
+        std::cerr << "cannot open " << path << '\n';
+        return std::nullopt;
+    }
+    std::string_view data = file->View();
+    if (data.substr(0, sizeof(kPolicyMagic) - 1) == kPolicyMagic) {
+        return ParseBinaryPolicy(path, data, threads);
+    }
+    return ParseTextPolicy(path, data, threads);
+}
+
+bool WriteBinaryPolicy(const std::string& path, const Policy& policy) {
+    size_t n = policy.subjects.size(), m = policy.objects.size();
+    uint64_t sizes[] = {n, m};
+    std::ofstream out(path, std::ios::binary);
+    out.write(kPolicyMagic, sizeof(kPolicyMagic) - 1);
+    out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    for (size_t s = 0; s != n; ++s) {
+        out.write(reinterpret_cast<const char*>(policy.matrix.Row(s)), m);
+    }
+    for (const auto* labels : {&policy.subjects, &policy.objects}) {
+        for (const Label& label : *labels) {
+            int32_t level = label.level;
+            out.write(reinterpret_cast<const char*>(&level), sizeof(level));
+            out.write(reinterpret_cast<const char*>(label.categories.words), sizeof(label.categories.words));
+        }
+    }
+    return static_cast<bool>(out.flush());
+}
+
+// Вердикт, затем изменения системы со стандартного ввода
+template <typename System>
+void Run(System& cs, bool listViolations, size_t threads) {
+    if (cs.IsSafe()) {
+        std::cout << "Congrats! Your system is safe!" << '\n';
+    } else {
+        std::cout << "Warning! Your system is not safe!" << '\n';
+    }
+    if (listViolations) {
+        PrintViolations(cs.FindViolations());
+    }
+
+    std::string command, text;
+    while (std::cin >> command) {
+        size_t s, o;
+        Label level;
+        Rights rights;
+        if (command == "access" && std::cin >> s >> o >> text && ParseRights(text, rights) &&
+            s - 1 < cs.subjects() && o - 1 < cs.objects()) {
+            cs.SetAccess(s, o, rights);
+        } else if (command == "subject" && std::cin >> s >> level && s - 1 < cs.subjects()) {
+            cs.SetSubjectLevel(s, level);
+        } else if (command == "object" && std::cin >> o >> level && o - 1 < cs.objects()) {
+            cs.SetObjectLevel(o, level);
+        } else if (command == "violations") {
+            PrintViolations(cs.FindViolations());
+            continue;
+        } else if (command == "flows") {
+            InformationFlow flow(cs, threads);
+            PrintLeaks(flow, threads);
+            continue;
+        } else {
+            std::cout << "unknown command" << '\n';
+            std::cin.clear();
+            continue;
+        }
+        if (cs.IsSafe()) {
+            std::cout << "safe" << '\n';
+        } else {
+            std::cout << "not safe: " << cs.GetViolationsNumber() << " violation(s)" << '\n';
+        }
+    }
 }
 
 
-int main() {
+// Запуск: bell_lapadula [--threads N] [--violations] [--sparse] [--kernel scalar|sse|avx2] [--load file]
+//         bell_lapadula --pack text binary - перевод политики в двоичный формат
+//   --violations - вывести все нарушения, а не только вердикт
+//   --sparse     - разреженное хранилище: вместо матрицы вводится число
+//                  непустых ячеек и сами ячейки "s o права"
+//   --load file  - политика (матрица и метки) загружается из файла без
+//                  подсказок и эха, текстового или двоичного (см. LoadPolicy);
+//                  только с плотным хранилищем
+// Права ячейки - буквы r, w, a, e (например rw) либо "-", если прав нет.
+// После вердикта читаются изменения системы, после каждого - новый вердикт:
+//   access s o p   - права p субъекта s к объекту o
+//   subject s l    - уровень l субъекта s
+//   object o l     - уровень l объекта o
+// Уровень - метка "уровень" или "уровень:категории", например 2 или 2:0,5,17
+// (категории 0..255); метка доминирует другую, если её уровень не ниже и
+// она содержит все её категории.
+//   violations     - список текущих нарушений
+//   flows          - косвенные утечки: пары объектов, между которыми
+//                    информация течёт сверху вниз, с путём через субъекты
+int main(int argc, char* argv[]) {
+    if (argc == 4 && std::string(argv[1]) == "--pack") {
+        std::optional<Policy> policy = LoadPolicy(argv[2], std::thread::hardware_concurrency());
+        return policy && WriteBinaryPolicy(argv[3], *policy) ? 0 : 1;
+    }
+    size_t threads = 1;
+    bool listViolations = false;
+    bool sparse = false;
+    std::string load;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        } else if (arg == "--violations") {
+            listViolations = true;
+        } else if (arg == "--sparse") {
+            sparse = true;
+        } else if (arg == "--kernel" && i + 1 < argc) {
+            scanner = SelectScanner(argv[++i]);
+            if (scanner == nullptr) {
+                std::cerr << "kernel " << argv[i] << " is not supported" << '\n';
+                return 1;
+            }
+        } else if (arg == "--load" && i + 1 < argc) {
+            load = argv[++i];
+        } else {
+            std::cerr << "usage: bell_lapadula [--threads N] [--violations] [--sparse] [--kernel scalar|sse|avx2] [--load file]" << '\n';
+            return 1;
+        }
+    }
+    if (!load.empty()) {
+        if (sparse) {
+            std::cerr << "--load needs the dense matrix" << '\n';
+            return 1;
+        }
+        std::optional<Policy> policy = LoadPolicy(load, threads);
+        if (!policy) {
+            return 1;
+        }
+        ComputerSystem cs(std::move(policy->matrix), policy->subjects, policy->objects, threads);
+        Run(cs, listViolations, threads);
+        return 0;
+    }
+
     size_t n, m; // кол-во субъектов и кол-во объектов
     std::cout << "Enter the number of subjects and the number of objects: " << '\n';
     std::cin >> n >> m;
-    std::vector<std::vector<char>> A;
-    std::cout << "Enter the elements of access matrix: " << '\n';
-    EnterMatrix(n, m, A);
-    PrintMatrix(A);
-    std::vector<int> LS;
+    DenseMatrix dense(sparse ? 0 : n, sparse ? 0 : m);
+    SparseMatrix cells(sparse ? n : 0, sparse ? m : 0);
+    if (sparse) {
+        size_t k;
+        std::cout << "Enter the number of granted cells and the cells: " << '\n';
+        std::cin >> k;
+        while (k--) {
+            size_t s, o;
+            std::string text;
+            Rights rights;
+            if (!(std::cin >> s >> o >> text) || !ParseRights(text, rights) || s - 1 >= n || o - 1 >= m) {
+                std::cerr << "invalid cell" << '\n';
+                return 1;
+            }
+            cells.Set(s - 1, o - 1, rights);
+        }
+    } else {
+        std::cout << "Enter the elements of access matrix: " << '\n';
+        if (!EnterMatrix(n, m, dense)) {
+            return 1;
+        }
+        PrintMatrix(n, m, dense);
+    }
+    std::vector<Label> LS;
     std::cout << "Enter subjects levels: ";
     EnterArray(n, LS);
-    std::vector<int> LO;
+    std::vector<Label> LO;
     std::cout << "Enter objects levels: ";
     EnterArray(m, LO);
-    ComputerSystem cs(n, m, A, LS, LO);
-    if (cs.IsSafe()) {
-        std::cout << "Congrats! Your system is safe!" << '\n';
+    if (!std::cin) {
+        std::cerr << "invalid levels" << '\n';
+        return 1;
+    }
+    if (sparse) {
+        SparseComputerSystem cs(std::move(cells), LS, LO, threads);
+        Run(cs, listViolations, threads);
     } else {
-        std::cout << "Warning! Your system is not safe!" << '\n';
+        ComputerSystem cs(std::move(dense), LS, LO, threads);
+        Run(cs, listViolations, threads);
     }
-}
\ No newline at end of file
+}
@@ -6,163 +6,1756 @@
 #include <set>
 #include <functional>
 #include <sstream>
+#include <cstdint>
+#include <bitset>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <string_view>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <filesystem>
+#include <unordered_map>
+#include <charconv>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define WALL_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Битовая строка доступа: бит o слова o / 64
+using Word = uint64_t;
+const size_t kWordBits = 64;
+
+inline size_t PopCount(Word w) {
+    return std::bitset<kWordBits>(w).count();
+}
+
+// Номер младшего единичного бита, w != 0
+inline size_t LowestBit(Word w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    return PopCount((w & (~w + 1)) - 1);
+#endif
+}
+
+// Двоичный журнал запросов: заголовок "CWL1", затем записи по 9 байт -
+// код операции (0 - start, 1 - read, 2 - write) и s, o как uint32 little-endian
+const char kLogMagic[] = "CWL1";
+const size_t kLogRecord = 9;
+
+inline void AppendRecord(std::string& data, uint8_t op, uint32_t s, uint32_t o) {
+    data += static_cast<char>(op);
+    for (uint32_t value : {s, o}) {
+        for (size_t k = 0; k != 4; ++k) {
+            data += static_cast<char>(value >> (8 * k));
+        }
+    }
+}
+
+// Последовательное чтение снимка с проверкой границ
+struct SnapshotReader {
+    const char* pos;
+    const char* end;
+
+    template <typename T>
+    bool Take(T* data, size_t count) {
+        if (static_cast<size_t>(end - pos) / sizeof(T) < count) {
+            return false;
+        }
+        if (count != 0) {
+            std::memcpy(data, pos, sizeof(T) * count);
+            pos += sizeof(T) * count;
+        }
+        return true;
+    }
+};
+
+template <typename T>
+void PutRaw(std::ostream& out, const T* data, size_t count) {
+    out.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+}
+
+// Номер фирмы или класса конфликта интересов
+using LabelId = uint32_t;
+
+inline void PutString(std::ostream& out, const std::string& value) {
+    uint32_t length = static_cast<uint32_t>(value.size());
+    PutRaw(out, &length, 1);
+    PutRaw(out, value.data(), value.size());
+}
+
+inline bool TakeString(SnapshotReader& in, std::string& value) {
+    uint32_t length;
+    if (!in.Take(&length, 1) || static_cast<size_t>(in.end - in.pos) < length) {
+        return false;
+    }
+    value.resize(length);
+    return in.Take(value.data(), length);
+}
+
+// Имена меток, сведённые к плотным номерам в порядке появления
+class LabelTable {
+private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, LabelId> ids;
+
+public:
+    static constexpr LabelId kUnknown = UINT32_MAX;
+
+    LabelId Intern(const std::string& name) {
+        auto [it, inserted] = ids.emplace(name, static_cast<LabelId>(names.size()));
+        if (inserted) {
+            names.push_back(name);
+        }
+        return it->second;
+    }
+
+    LabelId Find(const std::string& name) const {
+        auto it = ids.find(name);
+        return it == ids.end() ? kUnknown : it->second;
+    }
+
+    const std::string& Name(LabelId id) const {
+        return names[id];
+    }
+
+    size_t Size() const {
+        return names.size();
+    }
+
+    void Save(std::ostream& out) const {
+        uint32_t count = static_cast<uint32_t>(names.size());
+        PutRaw(out, &count, 1);
+        for (const auto& name : names) {
+            PutString(out, name);
+        }
+    }
+
+    bool Load(SnapshotReader& in) {
+        uint32_t count;
+        if (!in.Take(&count, 1)) {
+            return false;
+        }
+        names.clear();
+        ids.clear();
+        std::string name;
+        for (uint32_t i = 0; i != count; ++i) {
+            if (!TakeString(in, name) || Intern(name) != i) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Счётчики объектов в историях субъектов по номеру метки (фирмы или класса
+// конфликта). Субъект обычно касается немногих меток, поэтому у каждого
+// субъекта свой упорядоченный список ненулевых пар (метка, число).
+class LabelCounters {
+private:
+    using Counter = std::pair<LabelId, uint32_t>;
+
+    std::vector<std::vector<Counter>> rows;
+
+    static bool Less(const Counter& counter, LabelId label) {
+        return counter.first < label;
+    }
+
+public:
+    LabelCounters() = default;
+
+    explicit LabelCounters(size_t rows_) : rows(rows_) {}
+
+    uint32_t Get(size_t s, LabelId label) const {
+        const auto& row = rows[s];
+        auto it = std::lower_bound(row.begin(), row.end(), label, Less);
+        return it != row.end() && it->first == label ? it->second : 0;
+    }
+
+    void Add(size_t s, LabelId label, int delta) {
+        auto& row = rows[s];
+        auto it = std::lower_bound(row.begin(), row.end(), label, Less);
+        if (it == row.end() || it->first != label) {
+            it = row.insert(it, {label, 0});
+        }
+        it->second += delta;
+        if (it->second == 0) {
+            row.erase(it);
+        }
+    }
+
+    // visit(label, count) для ненулевых счётчиков субъекта s по возрастанию меток
+    template <typename Visitor>
+    void ForEach(size_t s, Visitor visit) const {
+        for (const auto& [label, count] : rows[s]) {
+            visit(label, count);
+        }
+    }
+
+    size_t Size(size_t s) const {
+        return rows[s].size();
+    }
+
+    void ClearRow(size_t s) {
+        rows[s].clear();
+    }
+
+    void Clear() {
+        for (auto& row : rows) {
+            row.clear();
+        }
+    }
+
+    void Save(std::ostream& out) const {
+        for (const auto& row : rows) {
+            uint32_t size = static_cast<uint32_t>(row.size());
+            PutRaw(out, &size, 1);
+            for (const auto& [label, count] : row) {
+                uint32_t pair[] = {label, count};
+                PutRaw(out, pair, 2);
+            }
+        }
+    }
+
+    // Метки должны быть меньше labels и идти по возрастанию, счётчики - не нулевые
+    bool Load(SnapshotReader& in, size_t labels) {
+        for (auto& row : rows) {
+            uint32_t size;
+            if (!in.Take(&size, 1) || static_cast<size_t>(in.end - in.pos) / 8 < size) {
+                return false;
+            }
+            row.resize(size);
+            for (size_t i = 0; i != size; ++i) {
+                uint32_t pair[2];
+                in.Take(pair, 2);
+                if (pair[0] >= labels || pair[1] == 0 || (i != 0 && pair[0] <= row[i - 1].first)) {
+                    return false;
+                }
+                row[i] = {pair[0], pair[1]};
+            }
+        }
+        return true;
+    }
+
+    // Сумма счётчиков субъекта s
+    uint64_t Total(size_t s) const {
+        uint64_t total = 0;
+        for (const auto& counter : rows[s]) {
+            total += counter.second;
+        }
+        return total;
+    }
+};
+
+
+template <typename T>
+void InsertSorted(std::vector<T>& values, T value) {
+    values.insert(std::lower_bound(values.begin(), values.end(), value), value);
+}
+
+template <typename T>
+void EraseSorted(std::vector<T>& values, T value) {
+    values.erase(std::lower_bound(values.begin(), values.end(), value));
+}
+
+
+// Журнал выданных доступов в формате двоичного журнала запросов. После
+// снимка в него дописываются новые доступы и команды start, поэтому
+// восстановление - это загрузка снимка и повтор хвоста журнала. Append
+// копит записи в буфере, Commit записывает их и дожидается диска; доступ
+// считается выданным только после Commit, иначе после падения стена
+// восстановилась бы без него. Если записать не удалось, файл обрезается до
+// последнего удачного Commit, а записи остаются в буфере до следующего.
+class Journal {
+private:
+    std::string path;
+    std::FILE* file = nullptr;
+    std::mutex lock;
+    std::string buffer;
+    uint64_t committed = 0; // размер файла после последней удачной записи
+
+    bool Write() {
+        if (file != nullptr && std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() &&
+            std::fflush(file) == 0 && Sync()) {
+            committed += buffer.size();
+            buffer.clear();
+            return true;
+        }
+        std::cerr << path << ": cannot write journal" << '\n';
+        // Часть записей могла дойти до файла - убираем её, иначе повтор
+        // записал бы их дважды
+        if (file != nullptr) {
+            file = std::freopen(path.c_str(), "ab", file);
+        }
+        std::error_code error;
+        std::filesystem::resize_file(path, committed, error);
+        if (error && file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        return false;
+    }
+
+    bool Sync() {
+#if defined(WALL_POSIX) && defined(__APPLE__)
+        return fsync(fileno(file)) == 0;
+#elif defined(WALL_POSIX)
+        return fdatasync(fileno(file)) == 0;
+#else
+        return true;
+#endif
+    }
+
+public:
+    explicit Journal(const std::string& path_) : path(path_) {
+        file = std::fopen(path.c_str(), "ab");
+        if (file != nullptr && std::fseek(file, 0, SEEK_END) == 0) {
+            committed = std::ftell(file);
+        }
+        if (file != nullptr && committed == 0) {
+            buffer = kLogMagic;
+            Write();
+        }
+    }
+
+    ~Journal() {
+        Commit();
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+
+    bool IsOpen() const {
+        return file != nullptr;
+    }
+
+    void Append(uint8_t op, uint32_t s, uint32_t o) {
+        std::lock_guard<std::mutex> guard(lock);
+        AppendRecord(buffer, op, s, o);
+    }
+
+    // Записи всех потоков уходят одним сбросом; если их уже записал другой
+    // поток, буфер пуст и ждать нечего
+    bool Commit() {
+        std::lock_guard<std::mutex> guard(lock);
+        return buffer.empty() || Write();
+    }
+
+    // Всё записанное вошло в снимок - начинаем журнал заново
+    void Restart() {
+        std::lock_guard<std::mutex> guard(lock);
+        file = std::freopen(path.c_str(), "wb", file);
+        committed = 0;
+        buffer = kLogMagic;
+        Write();
+    }
+};
+
+
+// Исходы решений Read, Write и SimpleSecurityCheck для статистики
+enum class Outcome : uint8_t {
+    READ_HELD,        // доступ уже был
+    READ_GRANTED,
+    READ_CONFLICT,    // в истории объект конкурирующей фирмы
+    READ_FLOW,        // косвенная утечка через прежние фирмы объектов
+    WRITE_HELD,
+    WRITE_GRANTED,
+    WRITE_CONFLICT,
+    WRITE_OTHER_FIRM, // в истории объекты других фирм
+    WRITE_FLOW,       // субъект знает данные других фирм
+    CHECK_PASSED,
+    CHECK_CONFLICT,
+    CHECK_FLOW,
+    COUNT
+};
+
+const size_t kOutcomes = static_cast<size_t>(Outcome::COUNT);
+
+constexpr bool IsAccepted(Outcome outcome) {
+    return outcome == Outcome::READ_HELD || outcome == Outcome::READ_GRANTED ||
+           outcome == Outcome::WRITE_HELD || outcome == Outcome::WRITE_GRANTED ||
+           outcome == Outcome::CHECK_PASSED;
+}
+
+#ifndef WALL_NO_STATS
+#define WALL_STATS 1
+#endif
+
+#ifdef WALL_STATS
+// Статистика решений: число исходов по причинам, гистограммы задержек и
+// счётчики решений по субъектам. Исходы и задержки копятся в шардах по
+// строкам кэша, шард - полоса блокировок субъекта. Решение записывается под
+// мьютексом этой полосы, поэтому счётчику хватает атомарных чтения и записи
+// без дорогого fetch_add, а отчёт читает их без блокировок. Задержка (с
+// ожиданием мьютекса) замеряется у каждого kSampleEvery-го решения потока,
+// корзина b гистограммы - задержки меньше 2^b нс.
+class WallStats {
+private:
+    static const size_t kBuckets = 32;
+    static const uint32_t kSampleEvery = 16;
+    static const size_t kOperations = 3; // read, write, check
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> outcomes[kOutcomes];
+        std::atomic<uint64_t> latency[kOperations][kBuckets];
+    };
+
+    size_t shardsNumber = 0;
+    std::unique_ptr<Shard[]> shards;
+    std::vector<std::atomic<uint32_t>> decisions;
+    std::vector<std::atomic<uint32_t>> refusals;
+
+    // Только под мьютексом, который охраняет счётчик
+    template <typename T>
+    static void Bump(std::atomic<T>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static uint64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static size_t OperationOf(Outcome outcome) {
+        return outcome < Outcome::WRITE_HELD ? 0 : outcome < Outcome::CHECK_PASSED ? 1 : 2;
+    }
+
+    uint64_t Total(Outcome outcome) const {
+        uint64_t total = 0;
+        for (size_t i = 0; i != shardsNumber; ++i) {
+            total += shards[i].outcomes[static_cast<size_t>(outcome)].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+public:
+    WallStats() = default;
+
+    WallStats(size_t subjects, size_t shards_) : shardsNumber(shards_), shards(new Shard[shards_]()),
+                                                 decisions(subjects), refusals(subjects) {}
+
+    // Отметка начала решения: время для замера или 0
+    uint64_t Begin() {
+        static thread_local uint32_t tick = 0;
+        return ++tick % kSampleEvery == 0 ? Now() : 0;
+    }
+
+    // Под мьютексом полосы shard, к которой относится субъект s
+    void Record(uint64_t start, size_t s, size_t shard_, Outcome outcome) {
+        Shard& shard = shards[shard_];
+        Bump(shard.outcomes[static_cast<size_t>(outcome)]);
+        if (start != 0) {
+            uint64_t elapsed = Now() - start;
+            size_t bucket = 0;
+            while (bucket + 1 != kBuckets && elapsed >> bucket != 0) {
+                ++bucket;
+            }
+            Bump(shard.latency[OperationOf(outcome)][bucket]);
+        }
+        Bump(decisions[s]);
+        if (!IsAccepted(outcome)) {
+            Bump(refusals[s]);
+        }
+    }
+
+    // Отчёт: исходы, задержки (границы перцентилей по замерам) и top
+    // субъектов с наибольшим числом решений
+    void Report(std::ostream& out, size_t top) const {
+        static const char* const kOutcomeNames[kOutcomes] = {
+            "read held", "read granted", "read refused: conflict", "read refused: flow",
+            "write held", "write granted", "write refused: conflict", "write refused: other firm",
+            "write refused: flow", "check passed", "check failed: conflict",
+            "check failed: flow"};
+        static const char* const kOperationNames[kOperations] = {"read", "write", "check"};
+        for (size_t i = 0; i != kOutcomes; ++i) {
+            out << kOutcomeNames[i] << ": " << Total(static_cast<Outcome>(i)) << '\n';
+        }
+        for (size_t op = 0; op != kOperations; ++op) {
+            uint64_t histogram[kBuckets] = {}, samples = 0;
+            for (size_t i = 0; i != shardsNumber; ++i) {
+                for (size_t b = 0; b != kBuckets; ++b) {
+                    histogram[b] += shards[i].latency[op][b].load(std::memory_order_relaxed);
+                }
+            }
+            for (uint64_t count : histogram) {
+                samples += count;
+            }
+            out << "latency " << kOperationNames[op] << ": samples " << samples;
+            const std::pair<double, const char*> kQuantiles[] = {{0.5, "p50"}, {0.9, "p90"}, {0.99, "p99"}, {1.0, "max"}};
+            for (const auto& [quantile, name] : kQuantiles) {
+                uint64_t seen = 0;
+                size_t b = 0;
+                while (b + 1 != kBuckets && (seen += histogram[b]) < quantile * samples) {
+                    ++b;
+                }
+                out << ' ' << name << " < " << (samples == 0 ? 0 : uint64_t(1) << b) << " ns";
+            }
+            out << '\n';
+        }
+        std::vector<uint32_t> hot;
+        for (size_t s = 0; s != decisions.size(); ++s) {
+            if (decisions[s].load(std::memory_order_relaxed) != 0) {
+                hot.push_back(static_cast<uint32_t>(s));
+            }
+        }
+        auto more = [&](uint32_t a, uint32_t b) {
+            uint32_t x = decisions[a].load(std::memory_order_relaxed), y = decisions[b].load(std::memory_order_relaxed);
+            return x != y ? x > y : a < b;
+        };
+        top = std::min(top, hot.size());
+        std::partial_sort(hot.begin(), hot.begin() + top, hot.end(), more);
+        out << "hot subjects:";
+        for (size_t i = 0; i != top; ++i) {
+            out << ' ' << hot[i] << " (" << decisions[hot[i]].load(std::memory_order_relaxed) << " decisions, "
+                << refusals[hot[i]].load(std::memory_order_relaxed) << " refused)";
+        }
+        out << '\n';
+    }
+};
+#else
+// Статистика отключена: пустые методы исчезают при встраивании
+class WallStats {
+public:
+    WallStats() = default;
+
+    WallStats(size_t, size_t) {}
+
+    uint64_t Begin() {
+        return 0;
+    }
+
+    void Record(uint64_t, size_t, size_t, Outcome) {}
+
+    void Report(std::ostream& out, size_t) const {
+        out << "statistics are disabled" << '\n';
+    }
+};
+#endif
+
+
+// Решения (Read, Write, SimpleSecurityCheck, Start) и запросы можно вызывать
+// из разных потоков. Субъекты разбиты на полосы по kLockStripes мьютексов:
+// проверка и выдача доступа идут под мьютексом полосы субъекта, так что
+// решения по разным субъектам почти не мешают друг другу. Биты матрицы
+// и размеры историй атомарны, поэтому запросы читают их без блокировок.
+// Метки (AddObject, SetConflict) задаются до начала работы из одного потока.
 class ChineseWall {
+public:
+    enum class Operation : uint8_t {
+        START,
+        READ,
+        WRITE
+    };
+
+    // Запрос пакетной обработки. Субъект или объект вне системы - отказ.
+    struct Request {
+        Operation op;
+        uint32_t s;
+        uint32_t o;
+    };
+
 private:
+    static const size_t kLockStripes = 256;
+    static const size_t kHotSubjects = 10;
+    static const char kSnapshotMagic[];
+
+    struct alignas(64) Stripe {
+        std::mutex lock;
+    };
+
     size_t subjects;
     size_t objects;
     size_t firms;
-    std::vector<std::vector<bool>> accessMatrix;
-    std::vector<std::pair<char, char>> securityLabels;
+    size_t words; // слов на строку матрицы доступа
+    // Строки субъектов подряд, по words слов. Матрица лежит либо в своём
+    // векторе, либо в отображённом в память снимке (копирование при записи).
+    std::vector<std::atomic<Word>> accessMatrix;
+    std::shared_ptr<void> mapping;
+    std::atomic<Word>* matrix = nullptr;
+    // Метки: фирма каждого объекта и класс конфликта интересов каждой фирмы.
+    // Обратные индексы - объекты фирмы и фирмы класса, по возрастанию.
+    LabelTable firmNames;
+    LabelTable conflictNames;
+    std::vector<LabelId> objectFirms;
+    std::vector<LabelId> firmConflicts;
+    std::vector<std::vector<uint32_t>> firmObjects;
+    std::vector<std::vector<LabelId>> conflictFirms;
+
+    // Сводка по истории каждого субъекта, обновляется при каждом доступе:
+    // сколько всего объектов, сколько из каждой фирмы и каждого класса
+    std::vector<std::atomic<uint32_t>> historySizes;
+    LabelCounters firmCounts;
+    LabelCounters conflictCounts;
+    // Start() лишь увеличивает эпоху; строка субъекта со старой эпохой
+    // считается пустой и обнуляется при первом обращении к нему
+    std::vector<std::atomic<uint32_t>> subjectEpochs;
+    std::atomic<uint32_t> epoch{0};
+    // Строки матрицы из снимка проверяются не при загрузке (её не читают
+    // целиком), а в Refresh при первом обращении к субъекту. Субъекту с
+    // испорченной строкой отказывается во всём. Под мьютексом полосы субъекта.
+    enum RowState : uint8_t {
+        ROW_CHECKED,
+        ROW_UNCHECKED,
+        ROW_CORRUPTED
+    };
+    std::vector<uint8_t> rowStates;
+    std::vector<Stripe> stripes;
+    // Обратный индекс: субъекты, обращавшиеся к объекту, в порядке доступа.
+    // Пополняется под мьютексом полосы объекта (его берут после мьютекса
+    // субъекта), очищается в Start().
+    std::vector<std::vector<uint32_t>> objectSubjects;
+    std::vector<Stripe> objectStripes;
+    // Косвенные потоки. В объекте лежат данные его фирмы, а после смены
+    // владельца - и прежних фирм (foreignFirms, по возрастанию; объекты с
+    // непустым списком - в taintedObjects). Свободные данные (kNone) в
+    // прежние не попадают, как и фирма, сменённая до первого обращения к
+    // объекту: обращались ли к нему хоть раз, помнит usedObjects, которое,
+    // в отличие от objectSubjects, Start не сбрасывает. Субъект знает
+    // данные всех фирм, лежащих в объектах его истории: фирм самих объектов
+    // (firmCounts) и прежних - foreignKnown считает объекты истории,
+    // несущие данные прежней фирмы.
+    // Пока субъект не касался помеченных объектов, строка пуста и проверки
+    // сводятся к счётчикам истории. Записи потоков не создают: Write
+    // требует, чтобы субъект знал только фирму объекта. Данные в объектах
+    // переживают Start, знания субъектов - нет.
+    std::vector<std::vector<LabelId>> foreignFirms;
+    std::vector<uint8_t> usedObjects;
+    std::vector<uint32_t> taintedObjects;
+    LabelCounters foreignKnown;
+    std::unique_ptr<Journal> journal;
+    WallStats stats;
+
+    // Исход решения в статистику (под мьютексом полосы s); результат -
+    // принято ли решение
+    bool Decide(uint64_t start, size_t s, Outcome outcome) {
+        stats.Record(start, s, s % kLockStripes, outcome);
+        return IsAccepted(outcome);
+    }
+
+    const std::atomic<Word>* Row(size_t s) const {
+        return matrix + s * words;
+    }
+
+    std::atomic<Word>* Row(size_t s) {
+        return matrix + s * words;
+    }
+
+    LabelId InternFirm(const std::string& f) {
+        LabelId firm = firmNames.Intern(f);
+        if (firm == firmObjects.size()) {
+            firmObjects.emplace_back();
+            firmConflicts.push_back(kNone);
+            conflictFirms[kNone].push_back(firm);
+        }
+        return firm;
+    }
+
+    LabelId InternConflict(const std::string& c) {
+        LabelId conflict = conflictNames.Intern(c);
+        if (conflict == conflictFirms.size()) {
+            conflictFirms.emplace_back();
+        }
+        return conflict;
+    }
+
+    // Обратные индексы по objectFirms и firmConflicts
+    void IndexLabels() {
+        firmObjects.assign(firmNames.Size(), {});
+        conflictFirms.assign(conflictNames.Size(), {});
+        for (size_t o = 0; o != objects; ++o) {
+            firmObjects[objectFirms[o]].push_back(static_cast<uint32_t>(o));
+        }
+        for (LabelId f = 0; f != firmConflicts.size(); ++f) {
+            conflictFirms[firmConflicts[f]].push_back(f);
+        }
+    }
+
+    void Log(Operation op, size_t s, size_t o) {
+        if (journal) {
+            journal->Append(static_cast<uint8_t>(op), static_cast<uint32_t>(s), static_cast<uint32_t>(o));
+        }
+    }
+
+    std::mutex& LockOf(size_t s) {
+        return stripes[s % kLockStripes].lock;
+    }
+
+    // Все мьютексы полос group; полосы объектов - только после полос субъектов
+    static std::vector<std::unique_lock<std::mutex>> LockAll(std::vector<Stripe>& group) {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(group.size());
+        for (auto& stripe : group) {
+            locks.emplace_back(stripe.lock);
+        }
+        return locks;
+    }
+
+    bool IsCurrent(size_t s) const {
+        return subjectEpochs[s].load(std::memory_order_acquire) == epoch.load(std::memory_order_acquire);
+    }
+
+    // Строка снимка: число битов равно размеру истории, биты за последним
+    // объектом не заняты
+    bool IsRowValid(size_t s) const {
+        size_t bits = 0;
+        for (size_t w = 0; w != words; ++w) {
+            bits += PopCount(Row(s)[w].load(std::memory_order_relaxed));
+        }
+        Word tail = objects % kWordBits == 0 ? 0 : ~Word(0) << (objects % kWordBits);
+        return bits == historySizes[s].load(std::memory_order_relaxed) &&
+               (words == 0 || (Row(s)[words - 1].load(std::memory_order_relaxed) & tail) == 0);
+    }
+
+    // Дальше - только под мьютексом полосы субъекта s. false - история
+    // субъекта испорчена, и решения по нему не принимаются.
+    bool Refresh(size_t s) {
+        if (!IsCurrent(s)) {
+            for (size_t w = 0; w != words; ++w) {
+                Row(s)[w].store(0, std::memory_order_relaxed);
+            }
+            historySizes[s].store(0, std::memory_order_relaxed);
+            firmCounts.ClearRow(s);
+            conflictCounts.ClearRow(s);
+            foreignKnown.ClearRow(s);
+            rowStates[s] = ROW_CHECKED;
+            subjectEpochs[s].store(epoch.load(), std::memory_order_release);
+        }
+        if (rowStates[s] == ROW_UNCHECKED) {
+            rowStates[s] = IsRowValid(s) ? ROW_CHECKED : ROW_CORRUPTED;
+            if (rowStates[s] == ROW_CORRUPTED) {
+                std::cerr << "snapshot: history of subject " << s << " is corrupted" << '\n';
+            }
+        }
+        return rowStates[s] != ROW_CORRUPTED;
+    }
+
+    // visit(f) для фирм, данные которых лежат в объекте o: его фирмы и прежних
+    template <typename Visitor>
+    void ForEachReach(size_t o, Visitor visit) const {
+        visit(objectFirms[o]);
+        for (LabelId f : foreignFirms[o]) {
+            visit(f);
+        }
+    }
+
+    bool IsHistoryEmpty(size_t s) {
+        return historySizes[s].load(std::memory_order_relaxed) == 0;
+    }
+
+    bool HasConflict(size_t s, size_t o) {
+        return conflictCounts.Get(s, GetConflict(o)) > HasAccess(s, o);
+    }
+
+    bool SameFirm(size_t s, size_t o) {
+        return firmCounts.Get(s, GetFirm(o)) > HasAccess(s, o);
+    }
+
+    // Обращался ли s к объектам не из фирмы объекта o
+    bool TouchedOtherFirms(size_t s, size_t o) {
+        return historySizes[s].load(std::memory_order_relaxed) > firmCounts.Get(s, GetFirm(o));
+    }
+
+    bool Check(size_t s, size_t o) {
+        return IsHistoryEmpty(s) || !HasConflict(s, o) || SameFirm(s, o);
+    }
+
+    // Знает ли s данные фирмы, конкурирующей с f (тот же класс, другая
+    // фирма): в истории есть объекты класса f не из f или такая фирма
+    // среди прежних фирм объектов истории
+    bool KnowsCompetitor(size_t s, LabelId f) const {
+        LabelId c = firmConflicts[f];
+        if (conflictCounts.Get(s, c) > firmCounts.Get(s, f)) {
+            return true;
+        }
+        bool found = false;
+        foreignKnown.ForEach(s, [&](LabelId known, uint32_t) {
+            found |= known != f && firmConflicts[known] == c;
+        });
+        return found;
+    }
+
+    // Чтение o свело бы у s данные конкурирующих фирм
+    bool LeaksTo(size_t s, size_t o) const {
+        bool leak = false;
+        ForEachReach(o, [&](LabelId f) {
+            leak = leak || KnowsCompetitor(s, f);
+        });
+        return leak;
+    }
+
+    // Решение Read для объекта не из истории: Check и нет утечки. Для фирмы
+    // самого объекта это значит, что все объекты истории из класса o - из
+    // фирмы o, то есть счётчики класса и фирмы равны. Прежние фирмы
+    // проверяются, только если они есть у объекта или в знаниях субъекта.
+    Outcome CheckRead(size_t s, size_t o) const {
+        if (conflictCounts.Get(s, GetConflict(o)) != firmCounts.Get(s, GetFirm(o))) {
+            return Outcome::READ_CONFLICT;
+        }
+        if ((foreignKnown.Size(s) == 0 && foreignFirms[o].empty()) || !LeaksTo(s, o)) {
+            return Outcome::READ_GRANTED;
+        }
+        return Outcome::READ_FLOW;
+    }
+
+    // Знает ли s данные прежних фирм, кроме фирмы объекта o (фирмы самих
+    // объектов истории проверяет TouchedOtherFirms)
+    bool KnowsOtherFirms(size_t s, size_t o) const {
+        return foreignKnown.Size(s) > (foreignKnown.Get(s, GetFirm(o)) != 0);
+    }
+
+    // Множество объектов, которые приняли бы Read или Write субъекта s, за
+    // один проход по меткам его истории, а не проверкой каждого объекта.
+    // Read отказывает только в объектах классов, которых субъект касался,
+    // кроме объектов фирм, которых он касался, и в объектах, чтение которых
+    // свело бы данные конкурентов; объекты истории доступны всегда.
+    // Write принимает любой объект при пустой истории, объекты единственной
+    // фирмы истории, если субъект знает только её, и ничего иначе. Стоимость -
+    // O(words) плюс объекты затронутых классов и помеченные объекты. Под
+    // мьютексом полосы субъекта s.
+    void FillAllowed(size_t s, Operation op, Word* row) {
+        auto setAll = [&](Word value) {
+            std::fill_n(row, words, value);
+            if (value != 0 && objects % kWordBits != 0) {
+                row[words - 1] = (Word(1) << (objects % kWordBits)) - 1;
+            }
+        };
+        auto markFirm = [&](LabelId f, Word bit) { // bit - новое значение битов объектов фирмы f
+            for (uint32_t o : firmObjects[f]) {
+                row[o / kWordBits] = (row[o / kWordBits] & ~(Word(1) << (o % kWordBits))) |
+                                     bit << (o % kWordBits);
+            }
+        };
+        if (IsHistoryEmpty(s)) {
+            setAll(~Word(0));
+        } else if (op == Operation::READ) {
+            setAll(~Word(0));
+            conflictCounts.ForEach(s, [&](LabelId c, uint32_t) {
+                for (LabelId f : conflictFirms[c]) {
+                    markFirm(f, 0);
+                }
+            });
+            firmCounts.ForEach(s, [&](LabelId f, uint32_t) {
+                markFirm(f, 1);
+            });
+            // Косвенные потоки: фирмы классов, где субъект знает другую фирму,
+            // и помеченные объекты с конкурентами среди прежних фирм
+            auto clearCompetitors = [&](LabelId known, uint32_t) {
+                for (LabelId f : conflictFirms[firmConflicts[known]]) {
+                    if (f != known) {
+                        markFirm(f, 0);
+                    }
+                }
+            };
+            firmCounts.ForEach(s, [&](LabelId known, uint32_t count) {
+                if (conflictCounts.Get(s, firmConflicts[known]) > count) {
+                    clearCompetitors(known, count); // в классе больше одной фирмы истории
+                }
+            });
+            foreignKnown.ForEach(s, clearCompetitors);
+            for (uint32_t o : taintedObjects) {
+                if (LeaksTo(s, o)) {
+                    row[o / kWordBits] &= ~(Word(1) << (o % kWordBits));
+                }
+            }
+            for (size_t w = 0; w != words; ++w) {
+                row[w] |= Row(s)[w].load(std::memory_order_relaxed); // доступ уже есть
+            }
+        } else {
+            setAll(0);
+            if (firmCounts.Size(s) == 1) {
+                firmCounts.ForEach(s, [&](LabelId f, uint32_t) {
+                    if (foreignKnown.Size(s) <= (foreignKnown.Get(s, f) != 0)) {
+                        markFirm(f, 1);
+                    }
+                });
+            }
+        }
+    }
+
+    // false, если доступ уже был
+    bool Grant(size_t s, size_t o) {
+        if (HasAccess(s, o)) {
+            return false;
+        }
+        Row(s)[o / kWordBits].fetch_or(Word(1) << (o % kWordBits), std::memory_order_relaxed);
+        historySizes[s].fetch_add(1, std::memory_order_relaxed);
+        firmCounts.Add(s, GetFirm(o), 1);
+        conflictCounts.Add(s, GetConflict(o), 1);
+        for (LabelId f : foreignFirms[o]) {
+            foreignKnown.Add(s, f, 1);
+        }
+        std::lock_guard<std::mutex> lock(objectStripes[o % kLockStripes].lock);
+        objectSubjects[o].push_back(static_cast<uint32_t>(s));
+        usedObjects[o] = 1;
+        return true;
+    }
+
+    // Start, Read и Write без ожидания журнала: запись только попадает в
+    // его буфер, сбрасывают её вызывающие
+    void NextEpoch() {
+        auto locks = LockAll(stripes);
+        auto objectLocks = LockAll(objectStripes); // objectSubjects читают под ними
+        if (epoch.load() + 1 == 0) {
+            // эпоха переполнилась - один раз чистим всё честно
+            for (size_t w = 0; w != subjects * words; ++w) {
+                matrix[w].store(0, std::memory_order_relaxed);
+            }
+            for (size_t s = 0; s != subjects; ++s) {
+                historySizes[s].store(0, std::memory_order_relaxed);
+                subjectEpochs[s].store(0, std::memory_order_relaxed);
+            }
+            firmCounts.Clear();
+            conflictCounts.Clear();
+            foreignKnown.Clear();
+            epoch.store(0);
+        } else {
+            epoch.fetch_add(1);
+        }
+        for (auto& accessors : objectSubjects) {
+            accessors.clear();
+        }
+        Log(Operation::START, 0, 0);
+    }
+
+    bool TryRead(size_t s, size_t o) {
+        uint64_t start = stats.Begin();
+        std::lock_guard<std::mutex> lock(LockOf(s));
+        if (!Refresh(s)) {
+            return Decide(start, s, Outcome::READ_CONFLICT);
+        }
+        if (HasAccess(s, o)) {
+            return Decide(start, s, Outcome::READ_HELD);
+        }
+        Outcome outcome = CheckRead(s, o);
+        if (outcome == Outcome::READ_GRANTED) {
+            Grant(s, o);
+            Log(Operation::READ, s, o);
+        }
+        return Decide(start, s, outcome);
+    }
+
+    bool TryWrite(size_t s, size_t o) {
+        uint64_t start = stats.Begin();
+        std::lock_guard<std::mutex> lock(LockOf(s));
+        if (!Refresh(s) || !Check(s, o)) {
+            return Decide(start, s, Outcome::WRITE_CONFLICT);
+        }
+        if (TouchedOtherFirms(s, o)) {
+            return Decide(start, s, Outcome::WRITE_OTHER_FIRM);
+        }
+        if (KnowsOtherFirms(s, o)) {
+            return Decide(start, s, Outcome::WRITE_FLOW);
+        }
+        if (!Grant(s, o)) {
+            return Decide(start, s, Outcome::WRITE_HELD);
+        }
+        Log(Operation::WRITE, s, o);
+        return Decide(start, s, Outcome::WRITE_GRANTED);
+    }
+
+public:
+    static const std::string NONE; // имя фирмы и класса с номером kNone
+    static constexpr LabelId kNone = 0;
+
+    ChineseWall() = default;
+
+    ChineseWall(size_t n, size_t m, size_t f) : subjects(n), objects(m), firms(f),
+                                                firmCounts(n), conflictCounts(n),
+                                                stripes(kLockStripes), objectSubjects(m),
+                                                objectStripes(kLockStripes), foreignFirms(m),
+                                                usedObjects(m, 0), foreignKnown(n), stats(n, kLockStripes) {
+        words = (m + kWordBits - 1) / kWordBits;
+        accessMatrix = std::vector<std::atomic<Word>>(n * words);
+        matrix = accessMatrix.data();
+        firmNames.Intern(NONE);
+        conflictNames.Intern(NONE);
+        objectFirms.assign(m, kNone);
+        firmConflicts.assign(1, kNone);
+        IndexLabels();
+        historySizes = std::vector<std::atomic<uint32_t>>(n);
+        subjectEpochs = std::vector<std::atomic<uint32_t>>(n);
+        rowStates.assign(n, ROW_CHECKED);
+    }
+
+    // Переносить можно только систему, с которой сейчас никто не работает
+    ChineseWall(ChineseWall&& other) noexcept
+        : subjects(other.subjects), objects(other.objects), firms(other.firms), words(other.words),
+          accessMatrix(std::move(other.accessMatrix)),
+          mapping(std::move(other.mapping)),
+          matrix(other.matrix),
+          firmNames(std::move(other.firmNames)),
+          conflictNames(std::move(other.conflictNames)),
+          objectFirms(std::move(other.objectFirms)),
+          firmConflicts(std::move(other.firmConflicts)),
+          firmObjects(std::move(other.firmObjects)),
+          conflictFirms(std::move(other.conflictFirms)),
+          historySizes(std::move(other.historySizes)),
+          firmCounts(std::move(other.firmCounts)),
+          conflictCounts(std::move(other.conflictCounts)),
+          subjectEpochs(std::move(other.subjectEpochs)),
+          epoch(other.epoch.load()),
+          rowStates(std::move(other.rowStates)),
+          stripes(std::move(other.stripes)),
+          objectSubjects(std::move(other.objectSubjects)),
+          objectStripes(std::move(other.objectStripes)),
+          foreignFirms(std::move(other.foreignFirms)),
+          usedObjects(std::move(other.usedObjects)),
+          taintedObjects(std::move(other.taintedObjects)),
+          foreignKnown(std::move(other.foreignKnown)),
+          journal(std::move(other.journal)),
+          stats(std::move(other.stats)) {}
+
+    // Снимок всего состояния; открытый журнал после этого начинается заново
+    bool Save(const std::string& path);
+    // Матрица снимка отображается в память, а не читается
+    static std::optional<ChineseWall> Load(const std::string& path);
+    // Повторяет записи журнала и дописывает в него дальнейшие доступы
+    bool OpenJournal(const std::string& path);
+
+    // Дожидается записи журнала на диск; false - записи не сохранены
+    bool FlushJournal() {
+        return !journal || journal->Commit();
+    }
+
+    void Start() {
+        NextEpoch();
+        FlushJournal();
+    }
+
+    std::vector<Word> Process(const std::vector<Request>& requests, size_t threads = 1);
+
+    // Предсказывает Read(s, o): то же решение, но без выдачи доступа
+    bool SimpleSecurityCheck(size_t s, size_t o) {
+        uint64_t start = stats.Begin();
+        std::lock_guard<std::mutex> lock(LockOf(s));
+        if (!Refresh(s)) {
+            return Decide(start, s, Outcome::CHECK_CONFLICT);
+        }
+        Outcome outcome = HasAccess(s, o) ? Outcome::READ_HELD : CheckRead(s, o);
+        return Decide(start, s, outcome == Outcome::READ_CONFLICT ? Outcome::CHECK_CONFLICT :
+                                outcome == Outcome::READ_FLOW ? Outcome::CHECK_FLOW : Outcome::CHECK_PASSED);
+    }
+
+    // Доступ сообщается выданным только после записи журнала на диск. Если
+    // журнал не записался, доступ остаётся в истории (это лишь строже) и
+    // выдаётся при повторном запросе, когда запись его всё-таки сохранит.
+    bool Read(size_t s, size_t o) {
+        return TryRead(s, o) && FlushJournal();
+    }
+
+    bool Write(size_t s, size_t o) {
+        return TryWrite(s, o) && FlushJournal();
+    }
+
+    // Отчёт статистики решений (kHotSubjects самых активных субъектов)
+    void ReportStats(std::ostream& out) const {
+        stats.Report(out, kHotSubjects);
+    }
+
+    // Объекты, которые сейчас приняли бы Read(s, o) при op == READ или
+    // Write(s, o) при op == WRITE: бит o в words словах
+    std::vector<Word> GetAllowed(size_t s, Operation op) {
+        std::vector<Word> row(words);
+        std::lock_guard<std::mutex> lock(LockOf(s));
+        if (Refresh(s)) {
+            FillAllowed(s, op, row.data());
+        }
+        return row;
+    }
+
+    // То же для многих субъектов: строка i результата (words слов) -
+    // субъект list[i], для субъекта вне системы строка пуста
+    std::vector<Word> GetAllowed(const std::vector<uint32_t>& list, Operation op, size_t threads = 1);
+
+    inline size_t GetWordsNumber() const {
+        return words;
+    }
+
+    void AddObject(size_t o, const std::string& f) {
+        LabelId old = objectFirms[o], firm = InternFirm(f);
+        if (old == firm) {
+            return;
+        }
+        EraseSorted(firmObjects[old], static_cast<uint32_t>(o));
+        InsertSorted(firmObjects[firm], static_cast<uint32_t>(o));
+        // Если к объекту уже обращались (в том числе до start), данные
+        // прежней фирмы остаются в нём (до первого обращения смена фирмы -
+        // просто исправление метки);
+        // знания его субъектов меняются на разницу старого и нового списка
+        // прежних фирм
+        auto& foreign = foreignFirms[o];
+        std::vector<LabelId> before = foreign;
+        if (auto it = std::lower_bound(foreign.begin(), foreign.end(), firm); it != foreign.end() && *it == firm) {
+            foreign.erase(it);
+        }
+        if (old != kNone && usedObjects[o]) {
+            InsertSorted(foreign, old);
+        }
+        objectFirms[o] = firm;
+        auto tainted = std::lower_bound(taintedObjects.begin(), taintedObjects.end(), static_cast<uint32_t>(o));
+        bool listed = tainted != taintedObjects.end() && *tainted == o;
+        if (listed && foreign.empty()) {
+            taintedObjects.erase(tainted);
+        } else if (!listed && !foreign.empty()) {
+            taintedObjects.insert(tainted, static_cast<uint32_t>(o));
+        }
+        LabelId oldConflict = firmConflicts[old], conflict = firmConflicts[firm];
+        for (uint32_t s : objectSubjects[o]) {
+            for (LabelId f : before) {
+                foreignKnown.Add(s, f, -1);
+            }
+            for (LabelId f : foreign) {
+                foreignKnown.Add(s, f, 1);
+            }
+            firmCounts.Add(s, old, -1);
+            firmCounts.Add(s, firm, 1);
+            if (oldConflict != conflict) {
+                conflictCounts.Add(s, oldConflict, -1);
+                conflictCounts.Add(s, conflict, 1);
+            }
+        }
+    }
+
+    // Класс конфликта - свойство фирмы, он же действует для объектов,
+    // добавленных в портфель позже
+    void SetConflict(const std::string& f, const std::string& c) {
+        LabelId firm = InternFirm(f), conflict = InternConflict(c), old = firmConflicts[firm];
+        if (old == conflict) {
+            return;
+        }
+        EraseSorted(conflictFirms[old], firm);
+        InsertSorted(conflictFirms[conflict], firm);
+        firmConflicts[firm] = conflict;
+        for (uint32_t o : firmObjects[firm]) {
+            for (uint32_t s : objectSubjects[o]) {
+                conflictCounts.Add(s, old, -1);
+                conflictCounts.Add(s, conflict, 1);
+            }
+        }
+    }
+
+    inline size_t GetFirmsNumber() const {
+        return firms;
+    }
+
+    inline size_t GetObjectsNumber() const {
+        return objects;
+    }
+
+    // Число объектов без владельца
+    inline size_t GetFreeObjectsNumber() const {
+        return firmObjects[kNone].size();
+    }
+
+    inline size_t GetSubjectsNumber() const {
+        return subjects;
+    }
+
+    inline LabelId GetFirm(size_t o) const {
+        return objectFirms[o];
+    }
+
+    inline LabelId GetConflict(size_t o) const {
+        return firmConflicts[objectFirms[o]];
+    }
+
+    inline LabelId GetFirmConflict(LabelId f) const {
+        return firmConflicts[f];
+    }
+
+    // Номера меток идут подряд с нуля; неизвестное имя - LabelTable::kUnknown
+    inline size_t GetFirmLabelsNumber() const {
+        return firmNames.Size();
+    }
 
-    bool IsHistoryEmpty(size_t s) {
-        return std::all_of(
-            accessMatrix[s].begin(),
-            accessMatrix[s].end(),
-            std::logical_not<bool>()
-        );
+    inline size_t GetConflictLabelsNumber() const {
+        return conflictNames.Size();
     }
 
-    bool HasConflict(size_t s, size_t o) {
-        for (size_t i = 0; i != objects; ++i) {
-            if (i != o) {
-                if (HasAccess(s, i) && (GetConflict(i) == GetConflict(o))) {
-                    return true;
+    inline LabelId FindFirm(const std::string& f) const {
+        return firmNames.Find(f);
+    }
+
+    inline LabelId FindConflict(const std::string& c) const {
+        return conflictNames.Find(c);
+    }
+
+    inline const std::string& GetFirmName(LabelId f) const {
+        return firmNames.Name(f);
+    }
+
+    inline const std::string& GetConflictName(LabelId c) const {
+        return conflictNames.Name(c);
+    }
+
+    inline bool HasAccess(size_t s, size_t o) const {
+        Word w = Row(s)[o / kWordBits].load(std::memory_order_relaxed);
+        return IsCurrent(s) && ((w >> (o % kWordBits)) & 1);
+    }
+
+    // Число объектов к которым имел доступ субъект s
+    size_t GetObjects(size_t s) const {
+        return IsCurrent(s) ? historySizes[s].load(std::memory_order_relaxed) : 0;
+    }
+
+    // Число субъектов обращавшихся к объекту o
+    size_t GetSubjects(size_t o) {
+        std::lock_guard<std::mutex> lock(objectStripes[o % kLockStripes].lock);
+        return objectSubjects[o].size();
+    }
+
+    // Субъекты, обращавшиеся к объекту o, по возрастанию
+    std::vector<uint32_t> GetAccessors(size_t o) {
+        std::vector<uint32_t> accessors;
+        {
+            std::lock_guard<std::mutex> lock(objectStripes[o % kLockStripes].lock);
+            accessors = objectSubjects[o];
+        }
+        std::sort(accessors.begin(), accessors.end());
+        return accessors;
+    }
+
+    // Вызывает visit(o) для объектов истории субъекта s по возрастанию
+    template <typename Visitor>
+    void ForEachObject(size_t s, Visitor visit) const {
+        if (!IsCurrent(s)) {
+            return;
+        }
+        for (size_t w = 0; w != words; ++w) {
+            for (Word bits = Row(s)[w].load(std::memory_order_relaxed); bits != 0; bits &= bits - 1) {
+                size_t o = w * kWordBits + LowestBit(bits);
+                if (o < objects) { // строку снимка могут ещё не проверить
+                    visit(o);
                 }
             }
         }
-        return false;
     }
 
-    bool SameFirm(size_t s, size_t o) {
-        for (size_t i = 0; i != objects; ++i) {
-            if (i != o) {
-                if (HasAccess(s, i) && (GetFirm(i) == GetFirm(o))) {
-                    return true;
+    // Фирмы, данные которых лежат в объекте o: его фирма, затем прежние
+    std::vector<LabelId> GetReach(size_t o) const {
+        std::vector<LabelId> firms;
+        ForEachReach(o, [&](LabelId f) { firms.push_back(f); });
+        return firms;
+    }
+
+    // Фирмы, данные которых знает субъект s, по возрастанию
+    std::vector<LabelId> GetKnownFirms(size_t s) {
+        std::vector<LabelId> firms;
+        std::lock_guard<std::mutex> lock(LockOf(s));
+        if (IsCurrent(s)) {
+            firmCounts.ForEach(s, [&](LabelId f, uint32_t) { firms.push_back(f); });
+            foreignKnown.ForEach(s, [&](LabelId f, uint32_t) { firms.push_back(f); });
+        }
+        std::sort(firms.begin(), firms.end());
+        firms.erase(std::unique(firms.begin(), firms.end()), firms.end());
+        return firms;
+    }
+
+    // Объекты с данными конкурирующих фирм. Такое возможно, только если
+    // объект сменил владельца, поэтому просматриваются лишь помеченные объекты.
+    std::vector<uint32_t> FindMixedObjects() const {
+        std::vector<uint32_t> mixed;
+        for (uint32_t o : taintedObjects) {
+            std::vector<LabelId> firms = GetReach(o);
+            for (size_t i = 0; i != firms.size(); ++i) {
+                if (std::any_of(firms.begin() + i + 1, firms.end(), [&](LabelId f) {
+                        return firmConflicts[f] == firmConflicts[firms[i]];
+                    })) {
+                    mixed.push_back(o);
+                    break;
                 }
             }
         }
-        return false;
+        return mixed;
     }
 
-public:
-    static const char NONE;
+    // Портфель компании: её объекты по возрастанию
+    const std::vector<uint32_t>& GetPortfolio(LabelId f) const {
+        return firmObjects[f];
+    }
 
-    ChineseWall() = default;
+    // Фирмы класса конфликта по возрастанию номеров
+    const std::vector<LabelId>& GetConflictFirms(LabelId c) const {
+        return conflictFirms[c];
+    }
 
-    ChineseWall(size_t n, size_t m, size_t f) : subjects(n), objects(m), firms(f) {
-        accessMatrix = std::vector<std::vector<bool>>(n, std::vector<bool>(m, false));
-        securityLabels = std::vector<std::pair<char, char>>(m, {NONE, NONE});
+    // Число объектов в портфеле компании
+    size_t GetFirmObjects(const std::string& f) const {
+        LabelId firm = FindFirm(f);
+        return firm == LabelTable::kUnknown ? 0 : firmObjects[firm].size();
     }
+};
 
-    void Start() {
-        for (auto& row : accessMatrix) {
-            std::replace(row.begin(), row.end(), true, false);
+const std::string ChineseWall::NONE = "_";
+
+// Журнал запросов для неинтерактивного воспроизведения. Два формата:
+//   текст   - команды start, read s o, write s o через пробельные символы;
+//   двоичный - см. AppendRecord.
+
+// Разбор текстового журнала без потоков ввода; exit завершает журнал.
+// При ошибке возвращает false, в pos - смещение неразобранной команды.
+bool ParseTextLog(std::string_view text, std::vector<ChineseWall::Request>& requests, size_t& pos) {
+    size_t i = 0;
+    auto isSpace = [&] { return text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r'); };
+    auto skipSpaces = [&] {
+        while (i != text.size() && isSpace()) {
+            ++i;
         }
-    }
+    };
+    auto number = [&](uint32_t& value) {
+        skipSpaces();
+        size_t begin = i;
+        uint64_t x = 0;
+        while (i != text.size() && text[i] >= '0' && text[i] <= '9' && x <= UINT32_MAX) {
+            x = x * 10 + (text[i++] - '0');
+        }
+        value = static_cast<uint32_t>(std::min<uint64_t>(x, UINT32_MAX));
+        return i != begin && (i == text.size() || isSpace());
+    };
 
-    bool SimpleSecurityCheck(size_t s, size_t o) {
-       return IsHistoryEmpty(s) || !HasConflict(s, o) || SameFirm(s, o);
+    while (skipSpaces(), i != text.size()) {
+        pos = i;
+        while (i != text.size() && !isSpace()) {
+            ++i;
+        }
+        std::string_view command = text.substr(pos, i - pos);
+        ChineseWall::Request request{ChineseWall::Operation::START, 0, 0};
+        if (command == "exit") {
+            break;
+        } else if (command == "read" || command == "write") {
+            request.op = command == "read" ? ChineseWall::Operation::READ : ChineseWall::Operation::WRITE;
+            if (!number(request.s) || !number(request.o)) {
+                return false;
+            }
+        } else if (command != "start") {
+            return false;
+        }
+        requests.push_back(request);
     }
+    return true;
+}
 
-    bool Read(size_t s, size_t o) {
-        if (accessMatrix[s][o]) {
-            return true;
+bool ParseBinaryLog(std::string_view data, std::vector<ChineseWall::Request>& requests, size_t& pos) {
+    auto load = [&](size_t at) {
+        uint32_t value = 0;
+        for (size_t k = 4; k != 0; --k) {
+            value = value << 8 | static_cast<unsigned char>(data[at + k - 1]);
         }
-        if (SimpleSecurityCheck(s, o)) {
-            accessMatrix[s][o] = true;
-            return true;
-        } 
-        return false;
+        return value;
+    };
+    requests.reserve(requests.size() + data.size() / kLogRecord);
+    for (pos = sizeof(kLogMagic) - 1; pos + kLogRecord <= data.size(); pos += kLogRecord) {
+        uint8_t op = static_cast<uint8_t>(data[pos]);
+        if (op > static_cast<uint8_t>(ChineseWall::Operation::WRITE)) {
+            return false;
+        }
+        requests.push_back({static_cast<ChineseWall::Operation>(op), load(pos + 1), load(pos + 5)});
     }
+    return pos == data.size();
+}
 
-    bool Write(size_t s, size_t o) {
-        if (SimpleSecurityCheck(s, o)) {
-            for (size_t i = 0; i != objects; ++i) {
-                if (accessMatrix[s][i] && GetFirm(i) != GetFirm(o)) {
-                    return false;
-                }
-            }
-            accessMatrix[s][o] = true;
-            return true;
-        }
+// Читает журнал любого из двух форматов, формат определяется по заголовку
+bool ReadLog(const std::string& path, std::vector<ChineseWall::Request>& requests) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "cannot open " << path << '\n';
         return false;
     }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string_view view(data);
+    size_t pos = 0;
+    bool binary = view.substr(0, sizeof(kLogMagic) - 1) == kLogMagic;
+    if (!(binary ? ParseBinaryLog(view, requests, pos) : ParseTextLog(view, requests, pos))) {
+        std::cerr << path << ": bad request at offset " << pos << '\n';
+        return false;
+    }
+    return true;
+}
 
-    void AddObject(size_t o, char f) {
-        securityLabels[o].second = f;
+bool WriteBinaryLog(const std::string& path, const std::vector<ChineseWall::Request>& requests) {
+    std::string data(kLogMagic);
+    data.reserve(data.size() + requests.size() * kLogRecord);
+    for (const auto& request : requests) {
+        AppendRecord(data, static_cast<uint8_t>(request.op), request.s, request.o);
     }
+    std::ofstream file(path, std::ios::binary);
+    return static_cast<bool>(file.write(data.data(), data.size()));
+}
 
-    void SetConflict(char f, char c) {
-        for (auto& o : securityLabels) {
-            if (o.second == f) {
-                o.first = c;
+// Пакетная обработка: бит i результата - решение по запросу i (start всегда
+// принимается), журнал записывается на диск до возврата результата; если
+// записать его не удалось, не принимается ничего. Решение зависит только
+// от истории своего субъекта, поэтому запросы между двумя start раздаются
+// потокам по полосам блокировок: порядок запросов каждого субъекта
+// сохраняется, а результат совпадает с последовательной обработкой.
+std::vector<Word> ChineseWall::Process(const std::vector<Request>& requests, size_t threads) {
+    const size_t kMinParallel = 4096; // меньшие отрезки дешевле пройти одним потоком
+    threads = std::max<size_t>(threads, 1);
+    std::vector<uint8_t> accepted(requests.size(), 0);
+    auto decide = [&](size_t i) {
+        const Request& r = requests[i];
+        if (r.s < subjects && r.o < objects) {
+            accepted[i] = r.op == Operation::READ ? TryRead(r.s, r.o) : TryWrite(r.s, r.o);
+        }
+    };
+
+    std::vector<std::vector<size_t>> queues(threads);
+    for (size_t begin = 0; begin != requests.size(); ) {
+        size_t end = begin;
+        while (end != requests.size() && requests[end].op != Operation::START) {
+            ++end;
+        }
+        if (threads == 1 || end - begin < kMinParallel) {
+            for (size_t i = begin; i != end; ++i) {
+                decide(i);
+            }
+        } else {
+            for (auto& queue : queues) {
+                queue.clear();
+            }
+            for (size_t i = begin; i != end; ++i) {
+                queues[requests[i].s % kLockStripes % threads].push_back(i);
+            }
+            std::vector<std::thread> workers;
+            for (const auto& queue : queues) {
+                workers.emplace_back([&decide, &queue] {
+                    for (size_t i : queue) {
+                        decide(i);
+                    }
+                });
             }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+        if (end != requests.size()) {
+            NextEpoch();
+            accepted[end++] = 1;
         }
+        begin = end;
+    }
+    if (!FlushJournal()) { // один сброс журнала на пакет
+        std::fill(accepted.begin(), accepted.end(), 0);
     }
 
-    inline size_t GetFirmsNumber() const {
-        return firms;
+    std::vector<Word> decisions((requests.size() + kWordBits - 1) / kWordBits);
+    for (size_t i = 0; i != requests.size(); ++i) {
+        decisions[i / kWordBits] |= Word(accepted[i]) << (i % kWordBits);
     }
+    return decisions;
+}
 
-    inline size_t GetObjectsNumber() const {
-        return objects;
+// Субъекты раздаются потокам блоками подряд; каждый поток пишет свои строки
+// результата и берёт мьютекс полосы очередного субъекта лишь на его строку
+std::vector<Word> ChineseWall::GetAllowed(const std::vector<uint32_t>& list, Operation op, size_t threads) {
+    const size_t kMinBlock = 64; // меньшие блоки дешевле пройти одним потоком
+    std::vector<Word> rows(list.size() * words);
+    auto fill = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i != end; ++i) {
+            if (list[i] < subjects) {
+                std::lock_guard<std::mutex> lock(LockOf(list[i]));
+                if (Refresh(list[i])) {
+                    FillAllowed(list[i], op, rows.data() + i * words);
+                }
+            }
+        }
+    };
+    threads = std::max<size_t>(1, std::min(threads, list.size() / kMinBlock));
+    size_t block = (list.size() + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(fill, std::min(list.size(), t * block), std::min(list.size(), (t + 1) * block));
     }
+    fill(0, std::min(list.size(), block));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return rows;
+}
 
-    // Число объектов без владельца
-    inline size_t GetFreeObjectsNumber() const {
-        return std::count_if(
-            securityLabels.begin(),
-            securityLabels.end(),
-            [](const auto& p){
-                return p.second == NONE;
+// Снимок: заголовок kSnapshotMagic и размеры (uint64), имена фирм и классов,
+// фирмы объектов и классы фирм, размеры и эпохи историй, счётчики меток и
+// знаний, списки субъектов и прежних фирм объектов, отметки обращений к
+// объектам (по байту), затем с границы страницы матрица
+// доступа - её Load отображает в память без чтения. Числа в порядке байт
+// машины, на которой снимок сделан.
+const char ChineseWall::kSnapshotMagic[] = "CWS5";
+const size_t kSnapshotAlign = 4096;
+
+bool ChineseWall::Save(const std::string& path) {
+    auto locks = LockAll(stripes);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        uint64_t header[] = {subjects, objects, firms, words, epoch.load()};
+        out.write(kSnapshotMagic, sizeof(kSnapshotMagic) - 1);
+        PutRaw(out, header, std::size(header));
+        firmNames.Save(out);
+        conflictNames.Save(out);
+        PutRaw(out, objectFirms.data(), objectFirms.size());
+        PutRaw(out, firmConflicts.data(), firmConflicts.size());
+        std::vector<uint32_t> values(subjects);
+        for (const auto* atomics : {&historySizes, &subjectEpochs}) {
+            for (size_t s = 0; s != subjects; ++s) {
+                values[s] = (*atomics)[s].load();
+            }
+            PutRaw(out, values.data(), values.size());
+        }
+        firmCounts.Save(out);
+        conflictCounts.Save(out);
+        foreignKnown.Save(out);
+        for (const auto* lists : {&objectSubjects, &foreignFirms}) {
+            for (const auto& list : *lists) {
+                uint32_t size = static_cast<uint32_t>(list.size());
+                PutRaw(out, &size, 1);
+                PutRaw(out, list.data(), list.size());
             }
-        );
+        }
+        PutRaw(out, usedObjects.data(), usedObjects.size());
+        std::string padding((kSnapshotAlign - out.tellp() % kSnapshotAlign) % kSnapshotAlign, '\0');
+        out.write(padding.data(), padding.size());
+        static_assert(sizeof(std::atomic<Word>) == sizeof(Word), "matrix is stored as plain words");
+        PutRaw(out, matrix, subjects * words);
+        if (!out.flush()) {
+            return false;
+        }
+    }
+#ifdef WALL_POSIX
+    // Журнал начинается заново, только когда снимок уже на диске
+    int fd = open(temporary.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!synced) {
+        return false;
     }
+#endif
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        return false;
+    }
+    if (journal) {
+        journal->Restart();
+    }
+    return true;
+}
 
-    inline size_t GetSubjectsNumber() const {
-        return subjects;
+std::optional<ChineseWall> ChineseWall::Load(const std::string& path) {
+#ifdef WALL_POSIX
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return std::nullopt;
+    }
+    size_t length = info.st_size;
+    void* base = length == 0 ? MAP_FAILED
+                             : mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return std::nullopt;
+    }
+    std::shared_ptr<void> mapping(base, [length](void* p) { munmap(p, length); });
+    SnapshotReader in{static_cast<const char*>(base), static_cast<const char*>(base) + length};
+#else
+    std::ifstream file(path, std::ios::binary);
+    std::string data;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    SnapshotReader in{data.data(), data.data() + data.size()};
+#endif
+    const char* begin = in.pos;
+    char magic[sizeof(kSnapshotMagic) - 1];
+    uint64_t header[5];
+    if (!in.Take(magic, std::size(magic)) || std::memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0 ||
+        !in.Take(header, std::size(header)) || header[3] != (header[1] + kWordBits - 1) / kWordBits ||
+        header[0] > UINT32_MAX || header[1] > UINT32_MAX) {
+        return std::nullopt;
+    }
+    // Субъект занимает в снимке не меньше пяти чисел, объект - трёх: так
+    // испорченные размеры отсекаются до выделения памяти
+    size_t rest = in.end - in.pos;
+    if (header[0] > rest / (5 * sizeof(uint32_t)) || header[1] > rest / (3 * sizeof(uint32_t))) {
+        return std::nullopt;
     }
 
-    inline char GetFirm(size_t o) const {
-        return securityLabels[o].second;
+    ChineseWall wall;
+    wall.subjects = header[0];
+    wall.objects = header[1];
+    wall.firms = header[2];
+    wall.words = header[3];
+    wall.epoch.store(static_cast<uint32_t>(header[4]));
+    if (!wall.firmNames.Load(in) || !wall.conflictNames.Load(in) || wall.firmNames.Size() == 0 ||
+        wall.conflictNames.Size() == 0) {
+        return std::nullopt;
+    }
+    wall.objectFirms.resize(wall.objects);
+    wall.firmConflicts.resize(wall.firmNames.Size());
+    std::vector<uint32_t> sizes(wall.subjects), epochs(wall.subjects);
+    wall.firmCounts = LabelCounters(wall.subjects);
+    wall.conflictCounts = LabelCounters(wall.subjects);
+    wall.foreignKnown = LabelCounters(wall.subjects);
+    if (!in.Take(wall.objectFirms.data(), wall.objects) ||
+        !in.Take(wall.firmConflicts.data(), wall.firmConflicts.size()) ||
+        !in.Take(sizes.data(), sizes.size()) || !in.Take(epochs.data(), epochs.size()) ||
+        !wall.firmCounts.Load(in, wall.firmNames.Size()) ||
+        !wall.conflictCounts.Load(in, wall.conflictNames.Size()) ||
+        !wall.foreignKnown.Load(in, wall.firmNames.Size())) {
+        return std::nullopt;
+    }
+    auto outside = [](const std::vector<LabelId>& ids, size_t size) {
+        return std::any_of(ids.begin(), ids.end(), [size](LabelId id) { return id >= size; });
+    };
+    if (outside(wall.objectFirms, wall.firmNames.Size()) ||
+        outside(wall.firmConflicts, wall.conflictNames.Size()) || outside(epochs, header[4] + 1)) {
+        return std::nullopt;
+    }
+    wall.objectSubjects.resize(wall.objects);
+    wall.foreignFirms.resize(wall.objects);
+    for (auto* lists : {&wall.objectSubjects, &wall.foreignFirms}) {
+        size_t limit = lists == &wall.objectSubjects ? wall.subjects : wall.firmNames.Size();
+        for (auto& list : *lists) {
+            uint32_t size;
+            if (!in.Take(&size, 1) || static_cast<size_t>(in.end - in.pos) / sizeof(uint32_t) < size) {
+                return std::nullopt;
+            }
+            list.resize(size);
+            if (!in.Take(list.data(), size) || outside(list, limit)) {
+                return std::nullopt;
+            }
+        }
+    }
+    wall.usedObjects.resize(wall.objects);
+    if (!in.Take(wall.usedObjects.data(), wall.objects)) {
+        return std::nullopt;
+    }
+    for (size_t o = 0; o != wall.objects; ++o) {
+        if (!wall.foreignFirms[o].empty()) {
+            wall.taintedObjects.push_back(static_cast<uint32_t>(o));
+        }
+    }
+    wall.historySizes = std::vector<std::atomic<uint32_t>>(wall.subjects);
+    wall.subjectEpochs = std::vector<std::atomic<uint32_t>>(wall.subjects);
+    for (size_t s = 0; s != wall.subjects; ++s) {
+        wall.historySizes[s].store(sizes[s]);
+        wall.subjectEpochs[s].store(epochs[s]);
     }
 
-    inline char GetConflict(size_t o) const {
-        return securityLabels[o].first;
+    in.pos = begin + (in.pos - begin + kSnapshotAlign - 1) / kSnapshotAlign * kSnapshotAlign;
+    size_t cells = wall.subjects * wall.words;
+    if (in.pos > in.end || static_cast<size_t>(in.end - in.pos) / sizeof(Word) != cells) {
+        return std::nullopt;
+    }
+#ifdef WALL_POSIX
+    wall.mapping = std::move(mapping);
+    wall.matrix = reinterpret_cast<std::atomic<Word>*>(const_cast<char*>(in.pos));
+#else
+    wall.accessMatrix = std::vector<std::atomic<Word>>(cells);
+    std::memcpy(static_cast<void*>(wall.accessMatrix.data()), in.pos, cells * sizeof(Word));
+    wall.matrix = wall.accessMatrix.data();
+#endif
+    // Размер истории текущего субъекта - сумма счётчиков фирм и классов.
+    // Строки матрицы сверяются с ним лениво, в Refresh.
+    wall.rowStates.assign(wall.subjects, ROW_CHECKED);
+    for (size_t s = 0; s != wall.subjects; ++s) {
+        if (epochs[s] != wall.epoch.load()) {
+            continue;
+        }
+        if (wall.firmCounts.Total(s) != sizes[s] || wall.conflictCounts.Total(s) != sizes[s]) {
+            return std::nullopt;
+        }
+        wall.rowStates[s] = ROW_UNCHECKED;
     }
+    wall.IndexLabels();
+    wall.stripes = std::vector<Stripe>(kLockStripes);
+    wall.objectStripes = std::vector<Stripe>(kLockStripes);
+    wall.stats = WallStats(wall.subjects, kLockStripes);
+    return wall;
+}
 
-    inline bool HasAccess(size_t s, size_t o) const {
-        return accessMatrix[s][o];
+bool ChineseWall::OpenJournal(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t magic = sizeof(kLogMagic) - 1;
+    if (!data.empty() && data.compare(0, magic, kLogMagic, std::min(magic, data.size())) != 0) {
+        return false;
+    }
+    // Хвост, оборванный на середине записи при падении, отбрасывается
+    size_t valid = data.size() < magic ? 0 : magic + (data.size() - magic) / kLogRecord * kLogRecord;
+    std::vector<Request> requests;
+    size_t pos = 0;
+    if (valid != 0 && !ParseBinaryLog(std::string_view(data).substr(0, valid), requests, pos)) {
+        return false;
+    }
+    std::error_code error;
+    if (valid != data.size()) {
+        std::filesystem::resize_file(path, valid, error);
     }
+    if (error) {
+        return false;
+    }
+    for (const auto& request : requests) {
+        if (request.op == Operation::START) {
+            Start();
+        } else if (request.s < subjects && request.o < objects) {
+            std::lock_guard<std::mutex> lock(LockOf(request.s));
+            if (Refresh(request.s)) {
+                Grant(request.s, request.o);
+            }
+        }
+    }
+    journal = std::make_unique<Journal>(path);
+    return journal->IsOpen();
+}
 
-    // Число объектов к которым имел доступ субъект s
-    size_t GetObjects(size_t s) const {
-        return std::count(accessMatrix[s].begin(), accessMatrix[s].end(), true);
+
+// Буфер вывода отчётов: строки и числа копятся в памяти и уходят в поток
+// кусками по kFlushSize байт, а не отдельными operator<<
+class ReportWriter {
+private:
+    static const size_t kFlushSize = 1 << 16;
+
+    std::ostream& out;
+    std::string buffer;
+
+public:
+    explicit ReportWriter(std::ostream& out_) : out(out_) {}
+
+    ~ReportWriter() {
+        Flush();
     }
 
-    // Число субъектов обращавшихся к объекту o
-    size_t GetSubjects(size_t o) const {
-        size_t count = 0;
-        for (size_t i = 0; i != subjects; ++i) {
-            if (accessMatrix[i][o]) {
-                ++count;
-            }
+    ReportWriter& operator<<(std::string_view text) {
+        buffer += text;
+        if (buffer.size() >= kFlushSize) {
+            Flush();
         }
-        return count;
+        return *this;
     }
 
-    // Число объектов в портфеле компании
-    size_t GetFirmObjects(char f) const {
-        return std::count_if(securityLabels.begin(),
-                          securityLabels.end(),
-                          [&](const auto& p){
-                            return p.second == f;
-                          });
+    ReportWriter& operator<<(size_t value) {
+        char digits[20];
+        char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        return *this << std::string_view(digits, end - digits);
     }
-};
 
-const char ChineseWall::NONE = '_';
+    void Flush() {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+};
 
 
 class ChineseWallContext {
@@ -173,42 +1766,93 @@ private:
 
     void PrintSubjectReport(size_t s) const {
         std::string delimiter = "\n";
-        for (size_t i = 0, n = wall.GetObjects(s); n != 0; ++i) {
-            if (wall.HasAccess(s, i)) {
-                out << "object: " << i;
-                if (char f = wall.GetFirm(i); f != ChineseWall::NONE) {
-                    out << " firm: " << f;
-                }
-                --n;
-                if (n != 0) {
-                    out << delimiter;
-                }
+        ReportWriter writer(out);
+        bool first = true;
+        wall.ForEachObject(s, [&](size_t o) {
+            if (!first) {
+                writer << delimiter;
             }
-        }
+            first = false;
+            writer << "object: " << o;
+            if (LabelId f = wall.GetFirm(o); f != ChineseWall::kNone) {
+                writer << " firm: " << wall.GetFirmName(f);
+            }
+        });
     }
 
     void PrintObjectReport(size_t o) {
         std::string delimiter = "\n";
-        for (size_t i = 0, n = wall.GetSubjects(o); n != 0; ++i) {
-            if (wall.HasAccess(i, o)) {
-                out << "subject: " << i;
-                --n;
-                if (n != 0) {
-                    out << delimiter;
-                }
+        ReportWriter writer(out);
+        std::vector<uint32_t> accessors = wall.GetAccessors(o);
+        for (auto it = accessors.begin(); it != accessors.end(); ) {
+            writer << "subject: " << *it;
+            ++it;
+            if (it != accessors.end()) {
+                writer << delimiter;
+            }
+        }
+    }
+
+    void PrintFirmPortfolio(const std::string& f) const {
+        std::string delimiter = "\n";
+        LabelId firm = wall.FindFirm(f);
+        if (firm == LabelTable::kUnknown) {
+            return;
+        }
+        ReportWriter writer(out);
+        const auto& portfolio = wall.GetPortfolio(firm);
+        for (auto it = portfolio.begin(); it != portfolio.end(); ) {
+            writer << "object: " << *it;
+            ++it;
+            if (it != portfolio.end()) {
+                writer << delimiter;
             }
         }
     }
 
-    void PrintFirmPortfolio(char f) const {
+    void PrintAllowed(size_t s, ChineseWall::Operation op) {
         std::string delimiter = "\n";
-        for (size_t i = 0, n = wall.GetFirmObjects(f); i != n; ++i) {
-            if (wall.GetFirm(i) == f) {
-                out << "object: " << i;
-                --n;
-                if (n != 0) {
-                    out << delimiter;
+        if (s >= wall.GetSubjectsNumber()) {
+            return;
+        }
+        std::vector<Word> allowed = wall.GetAllowed(s, op);
+        ReportWriter writer(out);
+        bool first = true;
+        for (size_t w = 0; w != allowed.size(); ++w) {
+            for (Word bits = allowed[w]; bits != 0; bits &= bits - 1) {
+                if (!first) {
+                    writer << delimiter;
                 }
+                first = false;
+                writer << "object: " << w * kWordBits + LowestBit(bits);
+            }
+        }
+    }
+
+    void PrintFirms(const std::vector<LabelId>& firms) {
+        std::string delimiter = "\n";
+        ReportWriter writer(out);
+        for (auto it = firms.begin(); it != firms.end(); ) {
+            writer << "firm: " << wall.GetFirmName(*it);
+            ++it;
+            if (it != firms.end()) {
+                writer << delimiter;
+            }
+        }
+    }
+
+    void PrintMixedObjects() {
+        std::string delimiter = "\n";
+        ReportWriter writer(out);
+        std::vector<uint32_t> mixed = wall.FindMixedObjects();
+        for (auto it = mixed.begin(); it != mixed.end(); ) {
+            writer << "object: " << *it << " firms:";
+            for (LabelId f : wall.GetReach(*it)) {
+                writer << " " << wall.GetFirmName(f);
+            }
+            ++it;
+            if (it != mixed.end()) {
+                writer << delimiter;
             }
         }
     }
@@ -221,12 +1865,19 @@ private:
         out << "report -s s - prints objects available for s" << '\n';
         out << "report -o o - prints subjects having access to o" << '\n';
         out << "briefcase f - prints objects possessed by f" << '\n';
+        out << "allowed -r s - prints objects s may read now" << '\n';
+        out << "allowed -w s - prints objects s may write now" << '\n';
+        out << "reach -o o  - prints firms whose data is in o" << '\n';
+        out << "reach -s s  - prints firms whose data s knows" << '\n';
+        out << "leaks       - prints objects holding data of competing firms" << '\n';
+        out << "save file   - save the system snapshot to file" << '\n';
+        out << "stats [file] - prints decision statistics or saves them to file" << '\n';
         out << "exit        - exit the program" << '\n'; 
     }
 
     void ReadCommand(const std::string& command) {
         size_t s, o;
-        char f;
+        std::string f;
         std::string flag;
         if (command == "help") {
             Help();
@@ -256,6 +1907,39 @@ private:
             in >> f;
             PrintFirmPortfolio(f);
             out << '\n';
+        } else if (command == "allowed") {
+            in >> flag >> s;
+            if (flag == "-r" || flag == "-w") {
+                PrintAllowed(s, flag == "-r" ? ChineseWall::Operation::READ : ChineseWall::Operation::WRITE);
+            } else {
+                out << "flags: -r for read, -w for write";
+            }
+            out << '\n';
+        } else if (command == "reach") {
+            in >> flag;
+            if (flag == "-o" && in >> o && o < wall.GetObjectsNumber()) {
+                PrintFirms(wall.GetReach(o));
+            } else if (flag == "-s" && in >> s && s < wall.GetSubjectsNumber()) {
+                PrintFirms(wall.GetKnownFirms(s));
+            } else if (flag != "-o" && flag != "-s") {
+                out << "flags: -o for object, -s for subject";
+            }
+            out << '\n';
+        } else if (command == "leaks") {
+            PrintMixedObjects();
+            out << '\n';
+        } else if (command == "stats") {
+            std::getline(in, f);
+            f.erase(0, f.find_first_not_of(" \t"));
+            if (f.empty()) {
+                wall.ReportStats(out);
+            } else {
+                out << (SaveStats(f)? "saved" : "failed") << '\n';
+            }
+        } else if (command == "save") {
+            in >> flag;
+            out << (wall.Save(flag)? "saved" : "failed");
+            out << '\n';
         } else {
             out << '\n';
         }
@@ -264,19 +1948,18 @@ private:
 public:
     ChineseWallContext(ChineseWall chineseWall, 
                         std::istream& in_, 
-                        std::ostream& out_) : wall(chineseWall), in(in_), out(out_) {
-        out << "Enter 'help' to get the list of all available commands." << '\n';
-    }
+                        std::ostream& out_) : wall(std::move(chineseWall)), in(in_), out(out_) {}
 
     ChineseWallContext(ChineseWall chineseWall,
-                       std::istream& in_) : ChineseWallContext(chineseWall, in_, std::cout) {}
+                       std::istream& in_) : ChineseWallContext(std::move(chineseWall), in_, std::cout) {}
 
     ChineseWallContext(ChineseWall chineseWall,
-                       std::ostream& out_) : ChineseWallContext(chineseWall, std::cin, out_) {}
+                       std::ostream& out_) : ChineseWallContext(std::move(chineseWall), std::cin, out_) {}
 
-    ChineseWallContext(ChineseWall chineseWall) : ChineseWallContext(chineseWall, std::cin, std::cout) {}
+    ChineseWallContext(ChineseWall chineseWall) : ChineseWallContext(std::move(chineseWall), std::cin, std::cout) {}
 
     void Run(const std::string& cursor) {
+        out << "Enter 'help' to get the list of all available commands." << '\n';
         std::string command;
         while (true) {
             out << cursor << ' ';
@@ -287,6 +1970,24 @@ public:
             ReadCommand(command);
         }  
     };
+
+    bool SaveStats(const std::string& path) const {
+        std::ofstream file(path);
+        wall.ReportStats(file);
+        return static_cast<bool>(file.flush());
+    }
+
+    // Неинтерактивное воспроизведение журнала: без приглашения и справки,
+    // решения по read и write выводятся через буфер в порядке запросов
+    void Replay(const std::vector<ChineseWall::Request>& requests, size_t threads) {
+        std::vector<Word> decisions = wall.Process(requests, threads);
+        ReportWriter writer(out);
+        for (size_t i = 0; i != requests.size(); ++i) {
+            if (requests[i].op != ChineseWall::Operation::START) {
+                writer << ((decisions[i / kWordBits] >> (i % kWordBits)) & 1 ? "accepted\n" : "refused\n");
+            }
+        }
+    }
 };
 
 
@@ -297,59 +1998,53 @@ private:
     
     void PrintObjectsAvailable(ChineseWall& wall) {
         std::string delimiter = ", ";
-        for (size_t i = 0, n = wall.GetFreeObjectsNumber(); n != 0; ++i) {
-            if (wall.GetFirm(i) == ChineseWall::NONE) {
-                out << i;
-                --n;
-                if (n != 0) {
-                    out << delimiter;
-                }
+        const auto& free = wall.GetPortfolio(ChineseWall::kNone);
+        for (auto it = free.begin(); it != free.end(); ) {
+            out << *it;
+            ++it;
+            if (it != free.end()) {
+                out << delimiter;
             }
         }
     }
 
-    void PrintAllFirms(ChineseWall& wall) {
+    void PrintNames(const std::set<std::string>& names) {
         std::string noMsg = "no";
         std::string delimiter = ", ";
-        std::set<char> letters;
-        for (size_t i = 0; i != wall.GetObjectsNumber(); ++i) {
-            if (wall.GetFirm(i) != ChineseWall::NONE) {
-                letters.insert(wall.GetFirm(i));
-            }
-        }
-        if (letters.empty()) {
+        if (names.empty()) {
             out << noMsg;
             return;
         }
-        for (auto it = letters.begin(); it != letters.end(); ) {
+        for (auto it = names.begin(); it != names.end(); ) {
             out << *it;
             ++it;
-            if (it != letters.end()) {
+            if (it != names.end()) {
                 out << delimiter;
             }
         }
     }
 
-    void PrintAllConflicts(ChineseWall& wall) {
-        std::string noMsg = "no";
-        std::string delimiter = ", ";
-        std::set<char> letters;
-        for (size_t i = 0; i != wall.GetObjectsNumber(); ++i) {
-            if (wall.GetConflict(i) != ChineseWall::NONE) {
-                letters.insert(wall.GetConflict(i));
+    // Фирмы, владеющие объектами
+    void PrintAllFirms(ChineseWall& wall) {
+        std::set<std::string> names;
+        for (LabelId f = 1; f != wall.GetFirmLabelsNumber(); ++f) {
+            if (!wall.GetPortfolio(f).empty()) {
+                names.insert(wall.GetFirmName(f));
             }
         }
-        if (letters.empty()) {
-            out << noMsg;
-            return;
-        }
-        for (auto it = letters.begin(); it != letters.end(); ) {
-            out << *it;
-            ++it;
-            if (it != letters.end()) {
-                out << delimiter;
+        PrintNames(names);
+    }
+
+    // Классы конфликта, в которых есть объекты
+    void PrintAllConflicts(ChineseWall& wall) {
+        std::set<std::string> names;
+        for (LabelId c = 1; c != wall.GetConflictLabelsNumber(); ++c) {
+            const auto& firms = wall.GetConflictFirms(c);
+            if (std::any_of(firms.begin(), firms.end(), [&wall](LabelId f) { return !wall.GetPortfolio(f).empty(); })) {
+                names.insert(wall.GetConflictName(c));
             }
         }
+        PrintNames(names);
     }
 
     void PrintAllSubjects(ChineseWall& wall) {
@@ -363,7 +2058,7 @@ private:
         }
     }
 
-    void SetPortfolio(ChineseWall& wall, char f) {
+    void SetPortfolio(ChineseWall& wall, const std::string& f) {
         out << "Enter firms object(s) (";
         PrintObjectsAvailable(wall);
         out << " available): ";
@@ -380,8 +2075,8 @@ private:
     void SetPortfolios(ChineseWall& wall) {
         out << "Please, set firms portfolios" << '\n';
         for (size_t i = 0; i != wall.GetFirmsNumber(); ++i) {
-            char f;
-            out << "Enter firm\'s letter (";
+            std::string f;
+            out << "Enter firm\'s name (";
             PrintAllFirms(wall);
             out << " exist(s)): ";
             in >> f;    
@@ -389,8 +2084,8 @@ private:
         }
     }
 
-    void SetConflict(ChineseWall& wall, char f) {
-        char c;
+    void SetConflict(ChineseWall& wall, const std::string& f) {
+        std::string c;
         out << "Set a conflict class ";
         out << '(';
         PrintAllConflicts(wall);
@@ -402,8 +2097,8 @@ private:
     void SetConflicts(ChineseWall& wall) {
         out << "Please, set conflict classes" << '\n';
         for (size_t i = 0; i != wall.GetFirmsNumber(); ++i) {
-            char f;
-            out << "Enter a firm\'s letter ";
+            std::string f;
+            out << "Enter a firm\'s name ";
             out << '(';
             PrintAllFirms(wall);
             out << " exist(s)): ";
@@ -434,9 +2129,136 @@ ChineseWall WallBuilder::BuildWall() {
 }
 
 
-int main() {    
-    WallBuilder builder(std::cin, std::cout);
-    ChineseWall wall = builder.BuildWall();
-    ChineseWallContext context(wall);
-    context.Run("<3");
-}
\ No newline at end of file
+// Нагрузочный прогон: n субъектов, m объектов, f фирм (объекты раздаются
+// фирмам по кругу, фирмы попарно делят класс конфликта). Для 1, 2, 4, ...
+// потоков выполняется ops случайных чтений и записей, печатается пропускная
+// способность и число нарушений стены в итоговых историях (должно быть 0).
+int RunStress(size_t n, size_t m, size_t f, size_t ops) {
+    ChineseWall wall(n, m, f);
+    for (size_t o = 0; o != m; ++o) {
+        wall.AddObject(o, "F" + std::to_string(o % f));
+    }
+    for (size_t i = 0; i != f; ++i) {
+        wall.SetConflict("F" + std::to_string(i), "C" + std::to_string(i / 2));
+    }
+
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        wall.Start();
+        std::atomic<size_t> accepted{0};
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t != threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937_64 rng(t + 1);
+                size_t granted = 0;
+                for (size_t i = t; i < ops; i += threads) {
+                    size_t s = rng() % n, o = rng() % m;
+                    granted += (rng() & 1) ? wall.Read(s, o) : wall.Write(s, o);
+                }
+                accepted += granted;
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        // В каждом классе конфликта субъект видел объекты не более чем одной фирмы
+        size_t violations = 0;
+        for (size_t s = 0; s != n; ++s) {
+            std::vector<LabelId> seen(wall.GetConflictLabelsNumber(), LabelTable::kUnknown);
+            for (size_t o = 0; o != m; ++o) {
+                if (wall.HasAccess(s, o)) {
+                    LabelId& firm = seen[wall.GetConflict(o)];
+                    if (firm != LabelTable::kUnknown && firm != wall.GetFirm(o)) {
+                        ++violations;
+                    }
+                    firm = wall.GetFirm(o);
+                }
+            }
+        }
+        std::cout << "threads: " << threads
+                  << " ops/s: " << static_cast<size_t>(ops / elapsed.count())
+                  << " accepted: " << accepted
+                  << " violations: " << violations << '\n';
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    return 0;
+}
+
+
+// Запуск:
+//   chinese_wall [options]                 - система вводится с клавиатуры
+//   chinese_wall --stress n m f ops        - нагрузочный прогон
+//   chinese_wall --pack text binary        - перевод журнала в двоичный формат
+// Опции:
+//   --replay log      - система вводится без подсказок, затем воспроизводится журнал log
+//   --threads N       - число потоков для --replay
+//   --snapshot file   - система загружается из снимка file, если он есть
+//   --journal file    - журнал доступов: повторяется при запуске и пополняется
+//   --stats file      - по завершении записать статистику решений в file
+// Статистика собирается, если не задан макрос WALL_NO_STATS.
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() == 5 && args[0] == "--stress") {
+        return RunStress(std::stoul(args[1]), std::stoul(args[2]),
+                         std::stoul(args[3]), std::stoul(args[4]));
+    }
+    if (args.size() == 3 && args[0] == "--pack") {
+        std::vector<ChineseWall::Request> requests;
+        return ReadLog(args[1], requests) && WriteBinaryLog(args[2], requests) ? 0 : 1;
+    }
+
+    std::string replay, snapshot, journal, statistics;
+    size_t threads = 1;
+    for (size_t i = 0; i != args.size(); i += 2) {
+        if (i + 1 == args.size()) {
+            std::cerr << "missing value for " << args[i] << '\n';
+            return 1;
+        }
+        if (args[i] == "--replay") {
+            replay = args[i + 1];
+        } else if (args[i] == "--threads") {
+            threads = std::stoul(args[i + 1]);
+        } else if (args[i] == "--snapshot") {
+            snapshot = args[i + 1];
+        } else if (args[i] == "--journal") {
+            journal = args[i + 1];
+        } else if (args[i] == "--stats") {
+            statistics = args[i + 1];
+        } else {
+            std::cerr << "unknown option " << args[i] << '\n';
+            return 1;
+        }
+    }
+
+    std::vector<ChineseWall::Request> requests;
+    if (!replay.empty() && !ReadLog(replay, requests)) {
+        return 1;
+    }
+    bool restore = !snapshot.empty() && std::ifstream(snapshot);
+    std::ostream silent(nullptr);
+    WallBuilder builder(std::cin, replay.empty() ? std::cout : silent);
+    std::optional<ChineseWall> wall = restore ? ChineseWall::Load(snapshot) : builder.BuildWall();
+    if (!wall) {
+        std::cerr << snapshot << ": bad snapshot" << '\n';
+        return 1;
+    }
+    if (!journal.empty() && !wall->OpenJournal(journal)) {
+        std::cerr << journal << ": bad journal" << '\n';
+        return 1;
+    }
+    ChineseWallContext context(std::move(*wall));
+    if (replay.empty()) {
+        context.Run("<3");
+    } else {
+        context.Replay(requests, threads);
+    }
+    if (!statistics.empty() && !context.SaveStats(statistics)) {
+        std::cerr << statistics << ": cannot write statistics" << '\n';
+        return 1;
+    }
+}